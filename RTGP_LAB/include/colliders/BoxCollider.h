@@ -0,0 +1,46 @@
+#pragma once
+
+#include <utils/Transform.h>
+#include <glm/glm.hpp>
+
+/*
+    Oriented box. The pose is read from the model matrix of the transform, the same one used to
+    render the object: the columns give the axes (with their scale) and the translation.
+    halfExtents are in the local units of the model (1 for a cube from -1 to 1).
+    The particles are kept at offset distance from the faces
+*/
+class BoxCollider
+{
+private:
+public:
+    Transform* transform;
+    glm::vec3 halfExtents;
+    float offset;
+
+    BoxCollider(Transform* transform, glm::vec3 halfExtents, float offset = 0.02f){
+        this->transform = transform;
+        this->halfExtents = halfExtents;
+        this->offset = offset;
+    }
+
+    glm::vec3 Center() const { return glm::vec3(transform->modelMatrix[3]); }
+
+    // Unit axes and world half extents
+    void Axes(glm::vec3 axes[3], glm::vec3 &worldHalfExtents) const {
+        for(int i = 0; i < 3; i++){
+            const glm::vec3 column = glm::vec3(transform->modelMatrix[i]);
+            const float length = glm::length(column);
+            axes[i] = length > 1e-12f ? column / length : glm::vec3(i == 0, i == 1, i == 2);
+            worldHalfExtents[i] = halfExtents[i] * length;
+        }
+    }
+
+    // World axis aligned box, enlarged by the offset
+    void Bounds(glm::vec3 &min, glm::vec3 &max) const {
+        glm::vec3 axes[3], h;
+        Axes(axes, h);
+        const glm::vec3 extent = glm::abs(axes[0]) * h.x + glm::abs(axes[1]) * h.y + glm::abs(axes[2]) * h.z + glm::vec3(offset);
+        min = Center() - extent;
+        max = Center() + extent;
+    }
+};
@@ -7,7 +7,9 @@
 class CapsuleCollider
 {
 private:
-    /* data */
+    glm::vec3 previousA;
+    glm::vec3 previousB;
+    bool hasPreviousPose;
 public:
     float radius;
     Transform* p1;
@@ -17,5 +19,20 @@ public:
         this->p1 = p1Transform;
         this->p2 = p2Transform;
         this->radius = radius;
+        this->hasPreviousPose = false;
+    }
+
+    // Segment end points, the same ones used by Particle::CapsuleCollision
+    glm::vec3 A() const { return p1->GetTranslationVector(); }
+    glm::vec3 B() const { return p2->GetTranslationVector(); }
+    // Segment at the end of the previous physics step, used by the continuous collision
+    glm::vec3 PreviousA() const { return hasPreviousPose ? previousA : A(); }
+    glm::vec3 PreviousB() const { return hasPreviousPose ? previousB : B(); }
+
+    // Called after each physics step: the movement until the next step is swept
+    void StorePose(){
+        previousA = A();
+        previousB = B();
+        hasPreviousPose = true;
     }
 };
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <utils/Scene.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+/*
+	Uniform hash grid of the scene colliders, rebuilt at every physics step.
+	Spheres and capsules are inserted in all the cells touched by the bounding box of the
+	volume they swept since the previous step, boxes in the cells of their current bounds.
+	A particle then tests only the colliders of its own cell, a box (a patch of the cloth)
+	the colliders of the cells it covers, each reported once.
+	Planes are infinite and are always tested, they are not stored here.
+
+	The buckets are built with a counting sort (count, prefix sum, fill), so after
+	the first step no memory is allocated
+*/
+class ColliderBroadphase
+{
+private:
+	struct Entry
+	{
+		uint32_t index;		// in scene->spheres, scene->capsules or scene->boxes
+		uint32_t kind;		// 0 sphere, 1 capsule, 2 box
+	};
+	struct Box
+	{
+		glm::ivec3 min;
+		glm::ivec3 max;
+	};
+
+	float cellSize;
+	float invCellSize;
+	uint32_t tableMask;
+	uint32_t sphereCount;
+	uint32_t capsuleCount;
+
+	std::vector<Box> boxes;				// cells covered by each collider: spheres, capsules, boxes
+	std::vector<glm::vec3> sweptMin;	// world bounds of the swept volume of each collider
+	std::vector<glm::vec3> sweptMax;
+	std::vector<uint32_t> bucketStart;	// entries of bucket b are in [bucketStart[b], bucketStart[b+1])
+	std::vector<Entry> entries;
+	std::vector<uint32_t> cursor;		// fill position of each bucket, kept to avoid reallocations
+	mutable std::vector<uint32_t> visited;	// last box query that reported each collider
+	mutable uint32_t visit;
+
+	static uint32_t NextPowerOfTwo(uint32_t v)
+	{
+		uint32_t p = 1;
+		while(p < v)
+			p <<= 1;
+		return p;
+	}
+
+	glm::ivec3 Cell(const glm::vec3 &pos) const
+	{
+		return glm::ivec3((int)std::floor(pos.x * invCellSize), (int)std::floor(pos.y * invCellSize), (int)std::floor(pos.z * invCellSize));
+	}
+
+	uint32_t Bucket(const glm::ivec3 &cell) const
+	{
+		// classic spatial hashing primes (Teschner et al. 2003)
+		return (((uint32_t)cell.x * 73856093u) ^ ((uint32_t)cell.y * 19349663u) ^ ((uint32_t)cell.z * 83492791u)) & tableMask;
+	}
+
+	Box CellsOf(const glm::vec3 &min, const glm::vec3 &max) const
+	{
+		Box box;
+		box.min = Cell(min);
+		box.max = Cell(max);
+		return box;
+	}
+
+	// Position of a collider in boxes, sweptMin and sweptMax
+	uint32_t Slot(const Entry &entry) const
+	{
+		if(entry.kind == 0u)
+			return entry.index;
+		return entry.kind == 1u ? sphereCount + entry.index : sphereCount + capsuleCount + entry.index;
+	}
+
+	bool SweptOverlaps(size_t i, const glm::vec3 &min, const glm::vec3 &max) const
+	{
+		return glm::all(glm::lessThanEqual(sweptMin[i], max)) && glm::all(glm::greaterThanEqual(sweptMax[i], min));
+	}
+
+	template<typename F>
+	void ForEachCell(const Box &box, F f) const
+	{
+		for(int x = box.min.x; x <= box.max.x; x++)
+			for(int y = box.min.y; y <= box.max.y; y++)
+				for(int z = box.min.z; z <= box.max.z; z++)
+					f(Bucket(glm::ivec3(x, y, z)));
+	}
+
+public:
+	ColliderBroadphase() : cellSize(1.0f), invCellSize(1.0f), tableMask(0), sphereCount(0), capsuleCount(0), visit(0) {}
+
+	// radiusMultiplier enlarges the colliders like the narrow phase does (COLLISION_OFFSET_MULTIPLIER)
+	void Build(Scene *scene, float radiusMultiplier)
+	{
+		sphereCount = (uint32_t)scene->spheres.size();
+		capsuleCount = (uint32_t)scene->capsules.size();
+		const size_t boxCount = scene->boxes.size();
+		const size_t colliderCount = sphereCount + capsuleCount + boxCount;
+
+		entries.clear();
+		boxes.resize(colliderCount);
+		sweptMin.resize(colliderCount);
+		sweptMax.resize(colliderCount);
+		visited.resize(colliderCount, 0);
+		if(colliderCount == 0){
+			bucketStart.assign(2, 0);
+			tableMask = 0;
+			return;
+		}
+
+		// The cell follows the average collider size, but a single huge collider
+		// must not cover more than a few cells per axis
+		float sizeSum = 0.0f;
+		float sizeMax = 0.0f;
+		for(size_t i = 0; i < sphereCount; i++){
+			const float size = 2.0f * scene->spheres[i]->radius * radiusMultiplier;
+			sizeSum += size;
+			sizeMax = glm::max(sizeMax, size);
+		}
+		for(size_t i = 0; i < capsuleCount; i++){
+			const CapsuleCollider* capsule = scene->capsules[i];
+			const float size = glm::distance(capsule->A(), capsule->B()) + 2.0f * capsule->radius * radiusMultiplier;
+			sizeSum += size;
+			sizeMax = glm::max(sizeMax, size);
+		}
+		for(size_t i = 0; i < boxCount; i++){
+			const size_t b = sphereCount + capsuleCount + i;
+			scene->boxes[i]->Bounds(sweptMin[b], sweptMax[b]);
+			const glm::vec3 extent = sweptMax[b] - sweptMin[b];
+			const float size = glm::max(extent.x, glm::max(extent.y, extent.z));
+			sizeSum += size;
+			sizeMax = glm::max(sizeMax, size);
+		}
+		cellSize = glm::max(glm::max(sizeSum / colliderCount, sizeMax / 8.0f), 1e-3f);
+		invCellSize = 1.0f / cellSize;
+
+		for(size_t i = 0; i < sphereCount; i++){
+			const glm::vec3 center = scene->spheres[i]->Center();
+			const glm::vec3 previous = scene->spheres[i]->PreviousCenter();
+			const glm::vec3 extent(scene->spheres[i]->radius * radiusMultiplier);
+			sweptMin[i] = glm::min(center, previous) - extent;
+			sweptMax[i] = glm::max(center, previous) + extent;
+			boxes[i] = CellsOf(sweptMin[i], sweptMax[i]);
+		}
+		for(size_t i = 0; i < capsuleCount; i++){
+			const CapsuleCollider* capsule = scene->capsules[i];
+			const glm::vec3 a = capsule->A(), b = capsule->B();
+			const glm::vec3 previousA = capsule->PreviousA(), previousB = capsule->PreviousB();
+			const glm::vec3 extent(capsule->radius * radiusMultiplier);
+			sweptMin[sphereCount + i] = glm::min(glm::min(a, b), glm::min(previousA, previousB)) - extent;
+			sweptMax[sphereCount + i] = glm::max(glm::max(a, b), glm::max(previousA, previousB)) + extent;
+			boxes[sphereCount + i] = CellsOf(sweptMin[sphereCount + i], sweptMax[sphereCount + i]);
+		}
+		for(size_t i = sphereCount + capsuleCount; i < colliderCount; i++)
+			boxes[i] = CellsOf(sweptMin[i], sweptMax[i]);
+
+		size_t entryCount = 0;
+		for(size_t i = 0; i < colliderCount; i++){
+			const glm::ivec3 cells = boxes[i].max - boxes[i].min + glm::ivec3(1);
+			entryCount += (size_t)cells.x * cells.y * cells.z;
+		}
+		tableMask = NextPowerOfTwo((uint32_t)glm::max<size_t>(entryCount * 2, 64)) - 1;
+
+		// counting sort of the (bucket, collider) pairs
+		bucketStart.assign(tableMask + 2, 0);
+		for(size_t i = 0; i < colliderCount; i++)
+			ForEachCell(boxes[i], [this](uint32_t bucket){ bucketStart[bucket + 1]++; });
+		for(uint32_t b = 0; b <= tableMask; b++)
+			bucketStart[b + 1] += bucketStart[b];
+
+		entries.resize(bucketStart[tableMask + 1]);
+		cursor.assign(bucketStart.begin(), bucketStart.end() - 1);
+		for(size_t i = 0; i < colliderCount; i++)
+		{
+			Entry entry;
+			if(i < sphereCount){
+				entry.kind = 0u;
+				entry.index = (uint32_t)i;
+			} else if(i < sphereCount + capsuleCount){
+				entry.kind = 1u;
+				entry.index = (uint32_t)(i - sphereCount);
+			} else {
+				entry.kind = 2u;
+				entry.index = (uint32_t)(i - sphereCount - capsuleCount);
+			}
+			ForEachCell(boxes[i], [this, entry](uint32_t bucket){ entries[cursor[bucket]++] = entry; });
+		}
+	}
+
+	// Calls sphere(index) / capsule(index) / box(index) for the colliders binned in the cell of pos.
+	// Colliders of other cells hashed to the same bucket are reported too (the narrow phase discards them)
+	template<typename SphereF, typename CapsuleF, typename BoxF>
+	void Query(const glm::vec3 &pos, SphereF sphere, CapsuleF capsule, BoxF box) const
+	{
+		if(entries.empty())
+			return;
+		const uint32_t bucket = Bucket(Cell(pos));
+		for(uint32_t i = bucketStart[bucket]; i < bucketStart[bucket + 1]; i++)
+		{
+			if(entries[i].kind == 0u)
+				sphere(entries[i].index);
+			else if(entries[i].kind == 1u)
+				capsule(entries[i].index);
+			else
+				box(entries[i].index);
+		}
+	}
+
+	// Calls f(kind, index) once for each collider whose swept volume overlaps the box (kind 0 sphere,
+	// 1 capsule, 2 box), until f returns true. Only the buckets of the cells covered by the box are read,
+	// all the colliders are scanned when the box covers more cells than there are colliders.
+	// Returns true if f stopped the search
+	template<typename F>
+	bool ForEachOverlap(const glm::vec3 &min, const glm::vec3 &max, F f) const
+	{
+		const size_t colliderCount = sweptMin.size();
+		if(colliderCount == 0 || glm::any(glm::greaterThan(min, max)))
+			return false;
+
+		const glm::vec3 span = glm::floor(max * invCellSize) - glm::floor(min * invCellSize) + glm::vec3(1.0f);
+		if(span.x * span.y * span.z > (float)colliderCount){
+			for(uint32_t i = 0; i < (uint32_t)colliderCount; i++)
+			{
+				const uint32_t kind = i < sphereCount ? 0u : (i < sphereCount + capsuleCount ? 1u : 2u);
+				const uint32_t first = kind == 0u ? 0u : (kind == 1u ? sphereCount : sphereCount + capsuleCount);
+				if(SweptOverlaps(i, min, max) && f(kind, i - first))
+					return true;
+			}
+			return false;
+		}
+
+		if(++visit == 0){
+			std::fill(visited.begin(), visited.end(), 0u);
+			visit = 1;
+		}
+		const Box box = CellsOf(min, max);
+		for(int x = box.min.x; x <= box.max.x; x++)
+			for(int y = box.min.y; y <= box.max.y; y++)
+				for(int z = box.min.z; z <= box.max.z; z++)
+				{
+					const uint32_t bucket = Bucket(glm::ivec3(x, y, z));
+					for(uint32_t e = bucketStart[bucket]; e < bucketStart[bucket + 1]; e++)
+					{
+						const uint32_t i = Slot(entries[e]);
+						if(visited[i] == visit)
+							continue;
+						visited[i] = visit;
+						if(SweptOverlaps(i, min, max) && f(entries[e].kind, entries[e].index))
+							return true;
+					}
+				}
+		return false;
+	}
+
+	// True if the swept volume of at least one collider overlaps the box
+	bool Overlaps(const glm::vec3 &min, const glm::vec3 &max) const
+	{
+		return ForEachOverlap(min, max, [](uint32_t, uint32_t){ return true; });
+	}
+
+	size_t EntryCount() const { return entries.size(); }
+};
@@ -0,0 +1,435 @@
+#pragma once
+
+#include <utils/Scene.h>
+#include <utils/Particle.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+// SSE2 is always there on x64 (and on x86 with /arch:SSE2), CLOTH_NO_SIMD forces the scalar code
+#if !defined(CLOTH_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define CLOTH_SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+#define COLLIDER_BATCH_SIZE 4
+
+// Collider ids: kind in the 2 high bits, index in its table in the others
+#define COLLIDER_PLANE 0u
+#define COLLIDER_SPHERE 1u
+#define COLLIDER_CAPSULE 2u
+#define COLLIDER_BOX 3u
+#define COLLIDER_INDEX_MASK 0x3FFFFFFFu
+#define COLLIDER_ID(kind, index) (((kind) << 30) | (index))
+
+// A particle found inside a collider, with the direction it was pushed along
+struct ColliderContact
+{
+	uint32_t particle;
+	uint32_t collider;	// COLLIDER_ID
+	glm::vec3 normal;
+
+	ColliderContact(uint32_t particle, uint32_t collider, const glm::vec3 &normal) : particle(particle), collider(collider), normal(normal) {}
+};
+
+/*
+	Scene colliders flattened in structure of arrays tables, rebuilt once per physics step.
+	The narrow phase reads only these tables: no Transform is dereferenced and no model matrix
+	is decomposed inside the collision iterations.
+
+		plane		n.x + d <= 0 is below the plane
+		sphere		center, radius and radius^2 (already enlarged by the offset multiplier)
+		capsule		end point a, segment ab, 1 / |ab|^2, radius and radius^2
+		box			center, 3 unit axes, world half extents and offset
+
+	The box tests let the cloth skip the patches that cannot touch a collider.
+	CollideBatch resolves COLLIDER_BATCH_SIZE particles at once, one SSE lane per particle,
+	with a scalar fallback that gives the same results, and reports the contacts found.
+	Resolve handles a single (particle, collider) contact
+*/
+class ColliderTables
+{
+private:
+	float planeMultiplier;
+
+public:
+	std::vector<float> planeNx, planeNy, planeNz, planeD;
+	std::vector<float> sphereX, sphereY, sphereZ, sphereR, sphereR2;
+	std::vector<float> capsuleAx, capsuleAy, capsuleAz;
+	std::vector<float> capsuleABx, capsuleABy, capsuleABz, capsuleInvLength2;
+	std::vector<float> capsuleR, capsuleR2;
+	std::vector<float> boxX, boxY, boxZ;
+	std::vector<float> boxAxes;		// 9 per box: axis 0, 1, 2
+	std::vector<float> boxHx, boxHy, boxHz, boxOffset;
+
+	ColliderTables() : planeMultiplier(1.0f) {}
+
+	// radiusMultiplier is COLLISION_OFFSET_MULTIPLIER, the same enlargement of the Particle collisions
+	void Build(const Scene *scene, float radiusMultiplier)
+	{
+		planeMultiplier = radiusMultiplier;
+
+		const size_t planeCount = scene->planes.size();
+		planeNx.resize(planeCount); planeNy.resize(planeCount); planeNz.resize(planeCount); planeD.resize(planeCount);
+		for(size_t i = 0; i < planeCount; i++)
+		{
+			const glm::vec3 n = scene->planes[i]->normal;
+			planeNx[i] = n.x; planeNy[i] = n.y; planeNz[i] = n.z;
+			planeD[i] = -glm::dot(n, scene->planes[i]->transform->translation);
+		}
+
+		const size_t sphereCount = scene->spheres.size();
+		sphereX.resize(sphereCount); sphereY.resize(sphereCount); sphereZ.resize(sphereCount);
+		sphereR.resize(sphereCount); sphereR2.resize(sphereCount);
+		for(size_t i = 0; i < sphereCount; i++)
+		{
+			const glm::vec3 c = scene->spheres[i]->Center();
+			const float r = scene->spheres[i]->radius * radiusMultiplier;
+			sphereX[i] = c.x; sphereY[i] = c.y; sphereZ[i] = c.z;
+			sphereR[i] = r;
+			sphereR2[i] = r * r;
+		}
+
+		const size_t capsuleCount = scene->capsules.size();
+		capsuleAx.resize(capsuleCount); capsuleAy.resize(capsuleCount); capsuleAz.resize(capsuleCount);
+		capsuleABx.resize(capsuleCount); capsuleABy.resize(capsuleCount); capsuleABz.resize(capsuleCount);
+		capsuleInvLength2.resize(capsuleCount); capsuleR.resize(capsuleCount); capsuleR2.resize(capsuleCount);
+		for(size_t i = 0; i < capsuleCount; i++)
+		{
+			const glm::vec3 a = scene->capsules[i]->A();
+			const glm::vec3 ab = scene->capsules[i]->B() - a;
+			const float length2 = glm::dot(ab, ab);
+			const float r = scene->capsules[i]->radius * radiusMultiplier;
+			capsuleAx[i] = a.x; capsuleAy[i] = a.y; capsuleAz[i] = a.z;
+			capsuleABx[i] = ab.x; capsuleABy[i] = ab.y; capsuleABz[i] = ab.z;
+			capsuleInvLength2[i] = length2 > 1e-12f ? 1.0f / length2 : 0.0f;	// degenerate capsule: sphere in a
+			capsuleR[i] = r;
+			capsuleR2[i] = r * r;
+		}
+
+		const size_t boxCount = scene->boxes.size();
+		boxX.resize(boxCount); boxY.resize(boxCount); boxZ.resize(boxCount); boxAxes.resize(boxCount * 9);
+		boxHx.resize(boxCount); boxHy.resize(boxCount); boxHz.resize(boxCount); boxOffset.resize(boxCount);
+		for(size_t i = 0; i < boxCount; i++)
+		{
+			glm::vec3 axes[3], h;
+			scene->boxes[i]->Axes(axes, h);
+			const glm::vec3 c = scene->boxes[i]->Center();
+			boxX[i] = c.x; boxY[i] = c.y; boxZ[i] = c.z;
+			for(int a = 0; a < 3; a++){
+				boxAxes[i*9 + a*3 + 0] = axes[a].x;
+				boxAxes[i*9 + a*3 + 1] = axes[a].y;
+				boxAxes[i*9 + a*3 + 2] = axes[a].z;
+			}
+			boxHx[i] = h.x; boxHy[i] = h.y; boxHz[i] = h.z;
+			boxOffset[i] = scene->boxes[i]->offset;
+		}
+	}
+
+	// Conservative tests against a box: false only if no point of the box can touch the collider
+	bool PlaneTouches(size_t i, const glm::vec3 &min, const glm::vec3 &max) const
+	{
+		const glm::vec3 n(planeNx[i], planeNy[i], planeNz[i]);
+		const glm::vec3 center = (min + max) * 0.5f, extent = (max - min) * 0.5f;
+		return glm::dot(n, center) + planeD[i] - glm::dot(glm::abs(n), extent) <= 0.0f;
+	}
+	bool SphereTouches(size_t i, const glm::vec3 &min, const glm::vec3 &max) const
+	{
+		const glm::vec3 c(sphereX[i], sphereY[i], sphereZ[i]);
+		const glm::vec3 d = c - glm::clamp(c, min, max);
+		return glm::dot(d, d) <= sphereR2[i];
+	}
+	bool CapsuleTouches(size_t i, const glm::vec3 &min, const glm::vec3 &max) const
+	{
+		const glm::vec3 a(capsuleAx[i], capsuleAy[i], capsuleAz[i]);
+		const glm::vec3 b = a + glm::vec3(capsuleABx[i], capsuleABy[i], capsuleABz[i]);
+		const glm::vec3 r(capsuleR[i]);
+		return glm::all(glm::lessThanEqual(glm::min(a, b) - r, max)) && glm::all(glm::greaterThanEqual(glm::max(a, b) + r, min));
+	}
+	bool BoxTouches(size_t i, const glm::vec3 &min, const glm::vec3 &max) const
+	{
+		const float* u = &boxAxes[i * 9];
+		const glm::vec3 c(boxX[i], boxY[i], boxZ[i]);
+		const glm::vec3 extent = glm::abs(glm::vec3(u[0], u[1], u[2])) * boxHx[i] + glm::abs(glm::vec3(u[3], u[4], u[5])) * boxHy[i]
+									+ glm::abs(glm::vec3(u[6], u[7], u[8])) * boxHz[i] + glm::vec3(boxOffset[i]);
+		return glm::all(glm::lessThanEqual(c - extent, max)) && glm::all(glm::greaterThanEqual(c + extent, min));
+	}
+
+	// Pushes p out of one collider (COLLIDER_ID), normal receives the push direction.
+	// Returns false if p is not inside
+	bool Resolve(uint32_t collider, glm::vec3 &p, glm::vec3 &normal) const
+	{
+		const uint32_t i = collider & COLLIDER_INDEX_MASK;
+		const uint32_t kind = collider >> 30;
+		if(kind == COLLIDER_PLANE){
+			const glm::vec3 n(planeNx[i], planeNy[i], planeNz[i]);
+			const float s = glm::dot(n, p) + planeD[i];
+			if(s > 0.0f)
+				return false;
+			p += n * (-s * planeMultiplier);
+			normal = n;
+			return true;
+		}
+		if(kind == COLLIDER_BOX)
+			return ResolveBox(i, p, normal);
+
+		glm::vec3 d;
+		float r, r2;
+		if(kind == COLLIDER_SPHERE){
+			d = p - glm::vec3(sphereX[i], sphereY[i], sphereZ[i]);
+			r = sphereR[i];
+			r2 = sphereR2[i];
+		} else {
+			const glm::vec3 ab(capsuleABx[i], capsuleABy[i], capsuleABz[i]);
+			const glm::vec3 ap = p - glm::vec3(capsuleAx[i], capsuleAy[i], capsuleAz[i]);
+			const float t = glm::clamp(glm::dot(ap, ab) * capsuleInvLength2[i], 0.0f, 1.0f);
+			d = ap - ab * t;
+			r = capsuleR[i];
+			r2 = capsuleR2[i];
+		}
+		const float l2 = glm::dot(d, d);
+		if(l2 >= r2 || l2 <= 1e-12f)
+			return false;
+		const float length = glm::sqrt(l2);
+		normal = d / length;
+		p += normal * (r - length);
+		return true;
+	}
+
+	// True if the collider id still exists in the tables (the scene can change between two steps)
+	bool Exists(uint32_t collider) const
+	{
+		const uint32_t i = collider & COLLIDER_INDEX_MASK;
+		switch(collider >> 30){
+			case COLLIDER_PLANE: return i < planeD.size();
+			case COLLIDER_SPHERE: return i < sphereR.size();
+			case COLLIDER_CAPSULE: return i < capsuleR.size();
+			case COLLIDER_BOX: return i < boxOffset.size();
+		}
+		return false;
+	}
+
+	// Box: outside, p closer than the offset is pushed away from the closest point of the box.
+	// Inside, p leaves through the face of minimum penetration
+	bool ResolveBox(uint32_t i, glm::vec3 &p, glm::vec3 &normal) const
+	{
+		const float* u = &boxAxes[i * 9];
+		const glm::vec3 axes[3] = { glm::vec3(u[0], u[1], u[2]), glm::vec3(u[3], u[4], u[5]), glm::vec3(u[6], u[7], u[8]) };
+		const glm::vec3 h(boxHx[i], boxHy[i], boxHz[i]);
+		const glm::vec3 d = p - glm::vec3(boxX[i], boxY[i], boxZ[i]);
+		const float offset = boxOffset[i];
+		const glm::vec3 q(glm::dot(d, axes[0]), glm::dot(d, axes[1]), glm::dot(d, axes[2]));
+		const glm::vec3 e = q - glm::clamp(q, -h, h);
+		const float e2 = glm::dot(e, e);
+
+		glm::vec3 delta;
+		if(e2 > 1e-12f){
+			if(e2 >= offset * offset)
+				return false;
+			const float length = glm::sqrt(e2);
+			delta = e * ((offset - length) / length);
+		} else {
+			const glm::vec3 penetration = h - glm::abs(q);
+			const int a = penetration.x <= penetration.y && penetration.x <= penetration.z ? 0 : (penetration.y <= penetration.z ? 1 : 2);
+			delta = glm::vec3(0.0f);
+			delta[a] = (q[a] >= 0.0f ? 1.0f : -1.0f) * (penetration[a] + offset);
+		}
+		const glm::vec3 move = axes[0] * delta.x + axes[1] * delta.y + axes[2] * delta.z;
+		normal = glm::normalize(move);
+		p += move;
+		return true;
+	}
+
+	// Pushes count (<= COLLIDER_BATCH_SIZE) movable particles out of the listed planes,
+	// spheres, capsules and boxes, in this order, like the Particle collision functions do.
+	// batch holds indices in particles, every collider found inside is appended to contacts
+	void CollideBatch(std::vector<Particle> &particles, const uint32_t* batch, int count, const uint32_t* planes, size_t planeCount,
+						const uint32_t* spheres, size_t sphereCount, const uint32_t* capsules, size_t capsuleCount,
+						const uint32_t* boxes, size_t boxCount, std::vector<ColliderContact> &contacts) const
+	{
+#ifdef CLOTH_SIMD_SSE
+		// lanes after count repeat the first particle, their result is not written back
+		Particle* lane[COLLIDER_BATCH_SIZE];
+		for(int l = 0; l < COLLIDER_BATCH_SIZE; l++)
+			lane[l] = &particles[batch[l < count ? l : 0]];
+		__m128 px = _mm_setr_ps(lane[0]->pos.x, lane[1]->pos.x, lane[2]->pos.x, lane[3]->pos.x);
+		__m128 py = _mm_setr_ps(lane[0]->pos.y, lane[1]->pos.y, lane[2]->pos.y, lane[3]->pos.y);
+		__m128 pz = _mm_setr_ps(lane[0]->pos.z, lane[1]->pos.z, lane[2]->pos.z, lane[3]->pos.z);
+		const __m128 startX = px, startY = py, startZ = pz;
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 epsilon = _mm_set1_ps(1e-12f);
+		const int laneMask = (1 << count) - 1;
+
+		for(size_t k = 0; k < planeCount; k++)
+		{
+			const uint32_t i = planes[k];
+			const __m128 nx = _mm_set1_ps(planeNx[i]), ny = _mm_set1_ps(planeNy[i]), nz = _mm_set1_ps(planeNz[i]);
+			const __m128 s = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, px), _mm_mul_ps(ny, py)), _mm_add_ps(_mm_mul_ps(nz, pz), _mm_set1_ps(planeD[i])));
+			const __m128 below = _mm_cmple_ps(s, zero);
+			const int hits = _mm_movemask_ps(below) & laneMask;
+			if(hits == 0)
+				continue;
+			const __m128 push = _mm_and_ps(below, _mm_mul_ps(s, _mm_set1_ps(-planeMultiplier)));
+			px = _mm_add_ps(px, _mm_mul_ps(nx, push));
+			py = _mm_add_ps(py, _mm_mul_ps(ny, push));
+			pz = _mm_add_ps(pz, _mm_mul_ps(nz, push));
+			for(int l = 0; l < count; l++)
+			{
+				if(hits & (1 << l))
+					contacts.push_back(ColliderContact(batch[l], COLLIDER_ID(COLLIDER_PLANE, i), glm::vec3(planeNx[i], planeNy[i], planeNz[i])));
+			}
+		}
+
+		for(size_t k = 0; k < sphereCount + capsuleCount; k++)
+		{
+			// closest point q of the sphere center or of the capsule segment, then the same push out
+			__m128 dx, dy, dz, r, r2;
+			uint32_t id;
+			if(k < sphereCount){
+				const uint32_t i = spheres[k];
+				dx = _mm_sub_ps(px, _mm_set1_ps(sphereX[i]));
+				dy = _mm_sub_ps(py, _mm_set1_ps(sphereY[i]));
+				dz = _mm_sub_ps(pz, _mm_set1_ps(sphereZ[i]));
+				r = _mm_set1_ps(sphereR[i]);
+				r2 = _mm_set1_ps(sphereR2[i]);
+				id = COLLIDER_ID(COLLIDER_SPHERE, i);
+			} else {
+				const uint32_t i = capsules[k - sphereCount];
+				const __m128 abx = _mm_set1_ps(capsuleABx[i]), aby = _mm_set1_ps(capsuleABy[i]), abz = _mm_set1_ps(capsuleABz[i]);
+				const __m128 ax = _mm_sub_ps(px, _mm_set1_ps(capsuleAx[i]));
+				const __m128 ay = _mm_sub_ps(py, _mm_set1_ps(capsuleAy[i]));
+				const __m128 az = _mm_sub_ps(pz, _mm_set1_ps(capsuleAz[i]));
+				__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, abx), _mm_mul_ps(ay, aby)), _mm_mul_ps(az, abz)), _mm_set1_ps(capsuleInvLength2[i]));
+				t = _mm_min_ps(_mm_max_ps(t, zero), one);
+				dx = _mm_sub_ps(ax, _mm_mul_ps(abx, t));
+				dy = _mm_sub_ps(ay, _mm_mul_ps(aby, t));
+				dz = _mm_sub_ps(az, _mm_mul_ps(abz, t));
+				r = _mm_set1_ps(capsuleR[i]);
+				r2 = _mm_set1_ps(capsuleR2[i]);
+				id = COLLIDER_ID(COLLIDER_CAPSULE, i);
+			}
+			const __m128 l2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+			const __m128 inside = _mm_and_ps(_mm_cmplt_ps(l2, r2), _mm_cmpgt_ps(l2, epsilon));
+			const int hits = _mm_movemask_ps(inside) & laneMask;
+			if(hits == 0)
+				continue;
+			const __m128 l = _mm_sqrt_ps(_mm_max_ps(l2, epsilon));
+			const __m128 invL = _mm_div_ps(one, l);
+			const __m128 scale = _mm_and_ps(inside, _mm_mul_ps(_mm_sub_ps(r, l), invL));
+			px = _mm_add_ps(px, _mm_mul_ps(dx, scale));
+			py = _mm_add_ps(py, _mm_mul_ps(dy, scale));
+			pz = _mm_add_ps(pz, _mm_mul_ps(dz, scale));
+
+			float normalX[COLLIDER_BATCH_SIZE], normalY[COLLIDER_BATCH_SIZE], normalZ[COLLIDER_BATCH_SIZE];
+			_mm_storeu_ps(normalX, _mm_mul_ps(dx, invL));
+			_mm_storeu_ps(normalY, _mm_mul_ps(dy, invL));
+			_mm_storeu_ps(normalZ, _mm_mul_ps(dz, invL));
+			for(int l = 0; l < count; l++)
+			{
+				if(hits & (1 << l))
+					contacts.push_back(ColliderContact(batch[l], id, glm::vec3(normalX[l], normalY[l], normalZ[l])));
+			}
+		}
+
+		const __m128 signBit = _mm_set1_ps(-0.0f);
+		for(size_t k = 0; k < boxCount; k++)
+		{
+			// local coordinates q, closest point of the box clamp(q, -h, h) and excess e = q - clamp
+			const uint32_t i = boxes[k];
+			const float* u = &boxAxes[i * 9];
+			const __m128 dx = _mm_sub_ps(px, _mm_set1_ps(boxX[i]));
+			const __m128 dy = _mm_sub_ps(py, _mm_set1_ps(boxY[i]));
+			const __m128 dz = _mm_sub_ps(pz, _mm_set1_ps(boxZ[i]));
+			const __m128 offset = _mm_set1_ps(boxOffset[i]);
+			__m128 q[3], h[3], e[3], penetration[3];
+			h[0] = _mm_set1_ps(boxHx[i]); h[1] = _mm_set1_ps(boxHy[i]); h[2] = _mm_set1_ps(boxHz[i]);
+			__m128 e2 = zero;
+			for(int a = 0; a < 3; a++)
+			{
+				q[a] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, _mm_set1_ps(u[a*3])), _mm_mul_ps(dy, _mm_set1_ps(u[a*3 + 1]))), _mm_mul_ps(dz, _mm_set1_ps(u[a*3 + 2])));
+				const __m128 clamped = _mm_min_ps(_mm_max_ps(q[a], _mm_xor_ps(h[a], signBit)), h[a]);
+				e[a] = _mm_sub_ps(q[a], clamped);
+				e2 = _mm_add_ps(e2, _mm_mul_ps(e[a], e[a]));
+				penetration[a] = _mm_sub_ps(h[a], _mm_andnot_ps(signBit, q[a]));
+			}
+			const __m128 outside = _mm_cmpgt_ps(e2, epsilon);
+			const __m128 skin = _mm_and_ps(outside, _mm_cmplt_ps(e2, _mm_mul_ps(offset, offset)));
+			const __m128 inside = _mm_andnot_ps(outside, _mm_castsi128_ps(_mm_set1_epi32(-1)));
+			const __m128 hitMask = _mm_or_ps(skin, inside);
+			const int hits = _mm_movemask_ps(hitMask) & laneMask;
+			if(hits == 0)
+				continue;
+
+			// outside: e scaled to the offset. Inside: the axis of minimum penetration, out of its nearest face
+			const __m128 l = _mm_sqrt_ps(_mm_max_ps(e2, epsilon));
+			const __m128 skinScale = _mm_and_ps(skin, _mm_div_ps(_mm_sub_ps(offset, l), l));
+			const __m128 first = _mm_and_ps(_mm_cmple_ps(penetration[0], penetration[1]), _mm_cmple_ps(penetration[0], penetration[2]));
+			const __m128 second = _mm_andnot_ps(first, _mm_cmple_ps(penetration[1], penetration[2]));
+			__m128 axisMask[3];
+			axisMask[0] = _mm_and_ps(inside, first);
+			axisMask[1] = _mm_and_ps(inside, second);
+			axisMask[2] = _mm_andnot_ps(_mm_or_ps(first, second), inside);
+			__m128 wx = zero, wy = zero, wz = zero;
+			for(int a = 0; a < 3; a++)
+			{
+				const __m128 leave = _mm_or_ps(_mm_add_ps(penetration[a], offset), _mm_and_ps(q[a], signBit));
+				const __m128 delta = _mm_add_ps(_mm_mul_ps(e[a], skinScale), _mm_and_ps(axisMask[a], leave));
+				wx = _mm_add_ps(wx, _mm_mul_ps(delta, _mm_set1_ps(u[a*3])));
+				wy = _mm_add_ps(wy, _mm_mul_ps(delta, _mm_set1_ps(u[a*3 + 1])));
+				wz = _mm_add_ps(wz, _mm_mul_ps(delta, _mm_set1_ps(u[a*3 + 2])));
+			}
+			px = _mm_add_ps(px, wx);
+			py = _mm_add_ps(py, wy);
+			pz = _mm_add_ps(pz, wz);
+
+			const __m128 moveLength2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(wx, wx), _mm_mul_ps(wy, wy)), _mm_mul_ps(wz, wz));
+			const __m128 invMove = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(moveLength2, epsilon)));
+			float normalX[COLLIDER_BATCH_SIZE], normalY[COLLIDER_BATCH_SIZE], normalZ[COLLIDER_BATCH_SIZE];
+			_mm_storeu_ps(normalX, _mm_mul_ps(wx, invMove));
+			_mm_storeu_ps(normalY, _mm_mul_ps(wy, invMove));
+			_mm_storeu_ps(normalZ, _mm_mul_ps(wz, invMove));
+			for(int l = 0; l < count; l++)
+			{
+				if(hits & (1 << l))
+					contacts.push_back(ColliderContact(batch[l], COLLIDER_ID(COLLIDER_BOX, i), glm::vec3(normalX[l], normalY[l], normalZ[l])));
+			}
+		}
+
+		float offsetX[COLLIDER_BATCH_SIZE], offsetY[COLLIDER_BATCH_SIZE], offsetZ[COLLIDER_BATCH_SIZE];
+		_mm_storeu_ps(offsetX, _mm_sub_ps(px, startX));
+		_mm_storeu_ps(offsetY, _mm_sub_ps(py, startY));
+		_mm_storeu_ps(offsetZ, _mm_sub_ps(pz, startZ));
+		for(int l = 0; l < count; l++)
+		{
+			if(offsetX[l] != 0.0f || offsetY[l] != 0.0f || offsetZ[l] != 0.0f)
+				lane[l]->offsetPos(glm::vec3(offsetX[l], offsetY[l], offsetZ[l]));
+		}
+#else
+		for(int l = 0; l < count; l++)
+		{
+			Particle &particle = particles[batch[l]];
+			glm::vec3 p = particle.pos;
+			const glm::vec3 start = p;
+			glm::vec3 normal;
+			for(size_t k = 0; k < planeCount + sphereCount + capsuleCount + boxCount; k++)
+			{
+				uint32_t id;
+				if(k < planeCount)
+					id = COLLIDER_ID(COLLIDER_PLANE, planes[k]);
+				else if(k < planeCount + sphereCount)
+					id = COLLIDER_ID(COLLIDER_SPHERE, spheres[k - planeCount]);
+				else if(k < planeCount + sphereCount + capsuleCount)
+					id = COLLIDER_ID(COLLIDER_CAPSULE, capsules[k - planeCount - sphereCount]);
+				else
+					id = COLLIDER_ID(COLLIDER_BOX, boxes[k - planeCount - sphereCount - capsuleCount]);
+				if(Resolve(id, p, normal))
+					contacts.push_back(ColliderContact(batch[l], id, normal));
+			}
+			if(p != start)
+				particle.offsetPos(p - start);
+		}
+#endif
+	}
+};
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <utils/Transform.h>
+#include <stb_image/stb_image.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cfloat>
+#include <iostream>
+
+#define HEIGHTFIELD_BATCH_SIZE 64
+
+/*
+	Terrain collider: a regular grid of heights in [0, 1] over the local XZ square of side size,
+	centered in the origin, scaled in height by relief. The heights come from a float grid or
+	from the gray levels of an image (row 0 at -z).
+
+	A query reads the 4 heights of the cell under the point: the height and the normal are the
+	bilinear interpolation and its derivatives, the distance is measured from the tangent plane.
+	The transform translation and uniform scale are applied to the queries. Rotation is not supported,
+	while the transform is rotated the collider is disabled (reported once) instead of being misaligned
+*/
+class HeightfieldCollider
+{
+private:
+	std::vector<float> heights;		// width * depth values, x fastest
+	int width;
+	int depth;
+	glm::vec2 size;					// local extent along x and z
+	float maxHeight;
+	mutable bool rotationReported;
+
+	void SetHeights(const std::vector<float> &values, int width, int depth)
+	{
+		if(width < 2 || depth < 2 || values.size() < (size_t)width * depth){
+			std::cout << "ERROR::HEIGHTFIELD_COLLIDER:: a grid of at least 2x2 heights is needed" << std::endl;
+			this->width = this->depth = 0;
+			return;
+		}
+		this->width = width;
+		this->depth = depth;
+		heights.assign(values.begin(), values.begin() + (size_t)width * depth);
+		maxHeight = 0.0f;
+		for(size_t i = 0; i < heights.size(); i++)
+			maxHeight = glm::max(maxHeight, heights[i]);
+	}
+
+public:
+	Transform* transform;
+	float relief;	// local height of the value 1
+	float offset;	// distance kept between the particles and the surface
+
+	HeightfieldCollider(const std::vector<float> &values, int width, int depth, Transform* transform, glm::vec2 size, float relief = 1.0f, float offset = 0.02f)
+	{
+		this->transform = transform;
+		this->size = size;
+		this->relief = relief;
+		this->offset = offset;
+		this->rotationReported = false;
+		SetHeights(values, width, depth);
+	}
+
+	// Gray levels of the image (the channels are averaged by stb_image)
+	HeightfieldCollider(const char* path, Transform* transform, glm::vec2 size, float relief = 1.0f, float offset = 0.02f)
+	{
+		this->transform = transform;
+		this->size = size;
+		this->relief = relief;
+		this->offset = offset;
+		this->rotationReported = false;
+
+		int w, h, channels;
+		unsigned char* image = stbi_load(path, &w, &h, &channels, 1);
+		if(image == nullptr){
+			std::cout << "ERROR::HEIGHTFIELD_COLLIDER:: failed to load " << path << std::endl;
+			width = depth = 0;
+			return;
+		}
+		std::vector<float> values((size_t)w * h);
+		for(size_t i = 0; i < values.size(); i++)
+			values[i] = image[i] / 255.0f;
+		stbi_image_free(image);
+		SetHeights(values, w, h);
+	}
+
+	bool IsValid() const { return width > 0; }
+
+	// Rotation of the transform farther than about 0.2 degrees from the identity
+	bool IsRotated() const
+	{
+		if(transform->rotation == nullptr || 1.0f - glm::abs(transform->rotation->w) < 1e-6f)
+			return false;
+		if(!rotationReported){
+			std::cout << "ERROR::HEIGHTFIELD_COLLIDER:: the transform is rotated, rotation is not supported: the collider is disabled" << std::endl;
+			rotationReported = true;
+		}
+		return true;
+	}
+
+	// World space box of the terrain, every point below it is pushed up.
+	// The box is empty (min > max) when the collider is not usable
+	void Bounds(glm::vec3 &min, glm::vec3 &max) const
+	{
+		if(!IsValid() || IsRotated()){
+			min = glm::vec3(FLT_MAX);
+			max = glm::vec3(-FLT_MAX);
+			return;
+		}
+		const glm::vec3 half = glm::vec3(size.x * 0.5f, 0.0f, size.y * 0.5f) * transform->scale;
+		min = transform->translation - half;
+		max = transform->translation + half;
+		min.y = -FLT_MAX;
+		max.y = transform->translation.y + glm::max(maxHeight * relief * transform->scale, 0.0f) + offset;
+	}
+
+	// Distance from the tangent plane of the terrain under up to HEIGHTFIELD_BATCH_SIZE positions
+	// and the unit normal, valid[i] is 0 for the positions outside the grid (all of them with a
+	// rotated transform). Same array loops of
+	// SDFCollider::SampleBatch: grid coordinates, gather of the 4 heights, interpolation
+	void SampleBatch(const glm::vec3* positions, size_t count, float* distances, glm::vec3* normals, unsigned char* valid) const
+	{
+		if(count > HEIGHTFIELD_BATCH_SIZE)
+			count = HEIGHTFIELD_BATCH_SIZE;
+		if(!IsValid() || IsRotated()){
+			for(size_t i = 0; i < count; i++)
+				valid[i] = 0;
+			return;
+		}
+
+		float fx[HEIGHTFIELD_BATCH_SIZE], fz[HEIGHTFIELD_BATCH_SIZE];
+		size_t index[HEIGHTFIELD_BATCH_SIZE];
+		float corner[4][HEIGHTFIELD_BATCH_SIZE];
+
+		const glm::vec2 cell = size / glm::vec2(width - 1, depth - 1);
+		const glm::vec2 toGrid = 1.0f / (cell * transform->scale);
+		const glm::vec2 gridOffset = glm::vec2(width - 1, depth - 1) * 0.5f - glm::vec2(transform->translation.x, transform->translation.z) * toGrid;
+		const glm::vec2 last = glm::vec2(width - 1, depth - 1);
+		for(size_t i = 0; i < count; i++)
+		{
+			const glm::vec2 g = glm::vec2(positions[i].x, positions[i].z) * toGrid + gridOffset;
+			valid[i] = (g.x >= 0.0f && g.y >= 0.0f && g.x <= last.x && g.y <= last.y) ? 1 : 0;
+			const glm::vec2 c = glm::floor(glm::clamp(g, glm::vec2(0.0f), last - 1.0f));
+			fx[i] = glm::clamp(g.x - c.x, 0.0f, 1.0f);
+			fz[i] = glm::clamp(g.y - c.y, 0.0f, 1.0f);
+			index[i] = (size_t)c.y * width + (size_t)c.x;
+		}
+
+		const size_t cornerOffset[4] = { 0, 1, (size_t)width, (size_t)width + 1 };
+		for(int c = 0; c < 4; c++)
+			for(size_t i = 0; i < count; i++)
+				corner[c][i] = heights[index[i] + cornerOffset[c]];
+
+		// heights and slopes in local units, the uniform scale does not change the normal
+		const float slopeX = relief / cell.x, slopeZ = relief / cell.y;
+		const float scaledRelief = relief * transform->scale;
+		const float baseY = transform->translation.y;
+		for(size_t i = 0; i < count; i++)
+		{
+			const float h0 = corner[0][i] + (corner[1][i] - corner[0][i]) * fx[i];
+			const float h1 = corner[2][i] + (corner[3][i] - corner[2][i]) * fx[i];
+			const float h = h0 + (h1 - h0) * fz[i];
+			const float dx = ((corner[1][i] - corner[0][i]) + ((corner[3][i] - corner[2][i]) - (corner[1][i] - corner[0][i])) * fz[i]) * slopeX;
+			const float dz = (h1 - h0) * slopeZ;
+			const float invLength = 1.0f / glm::sqrt(dx * dx + dz * dz + 1.0f);
+			normals[i] = glm::vec3(-dx * invLength, invLength, -dz * invLength);
+			distances[i] = (positions[i].y - (baseY + h * scaledRelief)) * invLength;
+		}
+	}
+
+	// Single query of SampleBatch, false outside the grid or with a rotated transform
+	bool Sample(const glm::vec3 &worldPos, float &distance, glm::vec3 &normal) const
+	{
+		unsigned char valid;
+		SampleBatch(&worldPos, 1, &distance, &normal, &valid);
+		return valid != 0;
+	}
+};
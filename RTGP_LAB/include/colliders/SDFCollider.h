@@ -0,0 +1,277 @@
+#pragma once
+
+#include <utils/Transform.h>
+#include <utils/model.h>
+#include <utils/Geometry.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+
+#define SDF_MAX_CELLS (256 * 256 * 256)
+#define SDF_BATCH_SIZE 64
+
+/*
+	Signed distance field collider baked from the triangles of a Model (negative inside).
+	The distances are exact only in a narrow band of bandCells cells around the surface,
+	the rest of the grid is clamped to +band (outside) or -band (inside, found with a flood fill
+	from the grid border). Baking costs O(triangles * band^3) and is done once, when the collider is created.
+
+	A query is a trilinear sample of the 8 grid values around the point, the gradient is the
+	derivative of the same interpolation. The grid is in the local space of the model: the
+	transform translation and uniform scale are applied to the queries. Rotation is not supported,
+	while the transform is rotated the collider is disabled (reported once) instead of giving wrong distances
+*/
+class SDFCollider
+{
+private:
+	std::vector<float> distances;	// (dim.x * dim.y * dim.z) values at the grid vertices, x fastest
+	glm::ivec3 dim;
+	glm::vec3 origin;				// local position of the vertex (0,0,0)
+	float cellSize;
+	float band;						// band width in local units
+	mutable bool rotationReported;
+
+	size_t Index(int x, int y, int z) const { return ((size_t)z * dim.y + y) * dim.x + x; }
+
+	void Bake(const Model &model, int bandCells)
+	{
+		glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+		for(size_t m = 0; m < model.meshes.size(); m++)
+		{
+			for(size_t v = 0; v < model.meshes[m].vertices.size(); v++)
+			{
+				min = glm::min(min, model.meshes[m].vertices[v].Position);
+				max = glm::max(max, model.meshes[m].vertices[v].Position);
+			}
+		}
+		if(min.x > max.x){
+			std::cout << "ERROR::SDF_COLLIDER:: the model has no vertices" << std::endl;
+			dim = glm::ivec3(0);
+			return;
+		}
+
+		band = bandCells * cellSize;
+		origin = min - glm::vec3(band + cellSize);
+		dim = glm::ivec3(glm::ceil((max - min) / cellSize)) + glm::ivec3(2 * bandCells + 3);
+		if((size_t)dim.x * dim.y * dim.z > SDF_MAX_CELLS){
+			std::cout << "ERROR::SDF_COLLIDER:: grid of " << dim.x << "x" << dim.y << "x" << dim.z << " cells is too big, use a larger cell size" << std::endl;
+			dim = glm::ivec3(0);
+			return;
+		}
+
+		// the alignment of the direction with the face normal breaks the ties on edges and vertices,
+		// where the closest point is shared by more triangles (approximation of the pseudo-normal)
+		distances.assign((size_t)dim.x * dim.y * dim.z, FLT_MAX);
+		std::vector<float> alignment(distances.size(), 0.0f);
+		for(size_t m = 0; m < model.meshes.size(); m++)
+		{
+			const Mesh &mesh = model.meshes[m];
+			for(size_t t = 0; t + 2 < mesh.indices.size(); t += 3)
+			{
+				const glm::vec3 a = mesh.vertices[mesh.indices[t]].Position;
+				const glm::vec3 b = mesh.vertices[mesh.indices[t+1]].Position;
+				const glm::vec3 c = mesh.vertices[mesh.indices[t+2]].Position;
+				glm::vec3 normal = glm::cross(b - a, c - a);
+				const float area = glm::length(normal);
+				if(area < 1e-12f)
+					continue;
+				normal /= area;
+
+				const glm::ivec3 from = glm::max(glm::ivec3(glm::floor((glm::min(glm::min(a, b), c) - band - origin) / cellSize)), glm::ivec3(0));
+				const glm::ivec3 to = glm::min(glm::ivec3(glm::ceil((glm::max(glm::max(a, b), c) + band - origin) / cellSize)), dim - 1);
+				for(int z = from.z; z <= to.z; z++)
+				for(int y = from.y; y <= to.y; y++)
+				for(int x = from.x; x <= to.x; x++)
+				{
+					const glm::vec3 p = origin + glm::vec3(x, y, z) * cellSize;
+					const glm::vec3 d = p - ClosestPointOnTriangle(p, a, b, c);
+					const float distance = glm::length(d);
+					if(distance > band)
+						continue;
+
+					const float cosine = distance > 1e-8f ? glm::dot(d, normal) / distance : 1.0f;
+					const size_t i = Index(x, y, z);
+					const float current = glm::abs(distances[i]);
+					if(distance < current - 1e-6f * cellSize ||
+						(distance < current + 1e-6f * cellSize && glm::abs(cosine) > alignment[i]))
+					{
+						distances[i] = cosine < 0.0f ? -distance : distance;
+						alignment[i] = glm::abs(cosine);
+					}
+				}
+			}
+		}
+
+		// Far cells: flood fill from the border through the cells that are outside,
+		// the far cells not reached are enclosed by the surface
+		std::vector<size_t> stack;
+		std::vector<char> outside(distances.size(), 0);
+		for(int z = 0; z < dim.z; z++)
+		for(int y = 0; y < dim.y; y++)
+		for(int x = 0; x < dim.x; x++)
+		{
+			if(x == 0 || y == 0 || z == 0 || x == dim.x-1 || y == dim.y-1 || z == dim.z-1){
+				const size_t i = Index(x, y, z);
+				if(distances[i] >= 0.0f){
+					outside[i] = 1;
+					stack.push_back(i);
+				}
+			}
+		}
+		while(!stack.empty())
+		{
+			const size_t i = stack.back();
+			stack.pop_back();
+			const int x = (int)(i % dim.x), y = (int)((i / dim.x) % dim.y), z = (int)(i / ((size_t)dim.x * dim.y));
+			const glm::ivec3 neighbours[6] = { glm::ivec3(x-1,y,z), glm::ivec3(x+1,y,z), glm::ivec3(x,y-1,z), glm::ivec3(x,y+1,z), glm::ivec3(x,y,z-1), glm::ivec3(x,y,z+1) };
+			for(int k = 0; k < 6; k++)
+			{
+				const glm::ivec3 &n = neighbours[k];
+				if(n.x < 0 || n.y < 0 || n.z < 0 || n.x >= dim.x || n.y >= dim.y || n.z >= dim.z)
+					continue;
+				const size_t j = Index(n.x, n.y, n.z);
+				if(!outside[j] && distances[j] >= 0.0f){
+					outside[j] = 1;
+					stack.push_back(j);
+				}
+			}
+		}
+		for(size_t i = 0; i < distances.size(); i++)
+		{
+			if(distances[i] == FLT_MAX)
+				distances[i] = outside[i] ? band : -band;
+		}
+	}
+
+public:
+	Transform* transform;
+	float offset;	// distance kept between the particles and the surface
+
+	// cellSize is in the local units of the model, bandCells the width of the exact band
+	SDFCollider(const Model &model, Transform* transform, float cellSize, int bandCells = 3, float offset = 0.02f)
+	{
+		this->transform = transform;
+		this->cellSize = cellSize;
+		this->offset = offset;
+		this->rotationReported = false;
+		Bake(model, bandCells);
+	}
+
+	bool IsValid() const { return dim.x > 0; }
+
+	// Rotation of the transform farther than about 0.2 degrees from the identity
+	bool IsRotated() const
+	{
+		if(transform->rotation == nullptr || 1.0f - glm::abs(transform->rotation->w) < 1e-6f)
+			return false;
+		if(!rotationReported){
+			std::cout << "ERROR::SDF_COLLIDER:: the transform is rotated, rotation is not supported: the collider is disabled" << std::endl;
+			rotationReported = true;
+		}
+		return true;
+	}
+
+	// World space box of the grid, outside of it the collider is never touched.
+	// The box is empty (min > max) when the collider is not usable
+	void Bounds(glm::vec3 &min, glm::vec3 &max) const
+	{
+		if(!IsValid() || IsRotated()){
+			min = glm::vec3(FLT_MAX);
+			max = glm::vec3(-FLT_MAX);
+			return;
+		}
+		min = transform->translation + origin * transform->scale;
+		max = transform->translation + (origin + glm::vec3(dim - 1) * cellSize) * transform->scale;
+	}
+
+	// Trilinear sample of the distance at a world position and its gradient (not normalized).
+	// Returns false outside the grid or with a rotated transform
+	bool Sample(const glm::vec3 &worldPos, float &distance, glm::vec3 &gradient) const
+	{
+		if(!IsValid() || IsRotated())
+			return false;
+
+		const glm::vec3 g = ((worldPos - transform->translation) / transform->scale - origin) / cellSize;
+		if(g.x < 0.0f || g.y < 0.0f || g.z < 0.0f || g.x >= dim.x - 1 || g.y >= dim.y - 1 || g.z >= dim.z - 1)
+			return false;
+
+		const int x = (int)g.x, y = (int)g.y, z = (int)g.z;
+		const glm::vec3 f = g - glm::vec3(x, y, z);
+		const size_t i = Index(x, y, z);
+		const size_t sy = (size_t)dim.x, sz = (size_t)dim.x * dim.y;
+		const float d000 = distances[i],			d100 = distances[i + 1];
+		const float d010 = distances[i + sy],		d110 = distances[i + sy + 1];
+		const float d001 = distances[i + sz],		d101 = distances[i + sz + 1];
+		const float d011 = distances[i + sy + sz],	d111 = distances[i + sy + sz + 1];
+
+		const float d00 = glm::mix(d000, d100, f.x), d10 = glm::mix(d010, d110, f.x);
+		const float d01 = glm::mix(d001, d101, f.x), d11 = glm::mix(d011, d111, f.x);
+		const float d0 = glm::mix(d00, d10, f.y), d1 = glm::mix(d01, d11, f.y);
+		distance = glm::mix(d0, d1, f.z) * transform->scale;
+
+		gradient.x = glm::mix(glm::mix(d100 - d000, d110 - d010, f.y), glm::mix(d101 - d001, d111 - d011, f.y), f.z);
+		gradient.y = glm::mix(glm::mix(d010 - d000, d110 - d100, f.x), glm::mix(d011 - d001, d111 - d101, f.x), f.z);
+		gradient.z = glm::mix(glm::mix(d001 - d000, d101 - d100, f.x), glm::mix(d011 - d010, d111 - d110, f.x), f.y);
+		return true;
+	}
+
+	// Sample of up to SDF_BATCH_SIZE positions, valid[i] is 0 for the positions outside the grid
+	// (all of them with a rotated transform).
+	// The work is split in plain loops over arrays (grid coordinates, gather of the corners,
+	// interpolation) that the compiler can vectorize, only the gather is scalar
+	void SampleBatch(const glm::vec3* positions, size_t count, float* batchDistances, glm::vec3* gradients, unsigned char* valid) const
+	{
+		if(count > SDF_BATCH_SIZE)
+			count = SDF_BATCH_SIZE;
+		if(!IsValid() || IsRotated()){
+			for(size_t i = 0; i < count; i++)
+				valid[i] = 0;
+			return;
+		}
+
+		float fx[SDF_BATCH_SIZE], fy[SDF_BATCH_SIZE], fz[SDF_BATCH_SIZE];
+		size_t index[SDF_BATCH_SIZE];
+		float corner[8][SDF_BATCH_SIZE];
+
+		const glm::vec3 toGrid = glm::vec3(1.0f / (transform->scale * cellSize));
+		const glm::vec3 gridOffset = -(transform->translation / transform->scale + origin) / cellSize;
+		const glm::vec3 last = glm::vec3(dim - 1);
+		for(size_t i = 0; i < count; i++)
+		{
+			const glm::vec3 g = positions[i] * toGrid + gridOffset;
+			valid[i] = (g.x >= 0.0f && g.y >= 0.0f && g.z >= 0.0f && g.x < last.x && g.y < last.y && g.z < last.z) ? 1 : 0;
+			const glm::vec3 clamped = glm::clamp(g, glm::vec3(0.0f), last - 1.0f);
+			const glm::vec3 cell = glm::floor(clamped);
+			fx[i] = g.x - cell.x;
+			fy[i] = g.y - cell.y;
+			fz[i] = g.z - cell.z;
+			index[i] = Index((int)cell.x, (int)cell.y, (int)cell.z);
+		}
+
+		const size_t sy = (size_t)dim.x, sz = (size_t)dim.x * dim.y;
+		const size_t cornerOffset[8] = { 0, 1, sy, sy + 1, sz, sz + 1, sy + sz, sy + sz + 1 };
+		for(int c = 0; c < 8; c++)
+			for(size_t i = 0; i < count; i++)
+				corner[c][i] = distances[index[i] + cornerOffset[c]];
+
+		for(size_t i = 0; i < count; i++)
+		{
+			const float d00 = corner[0][i] + (corner[1][i] - corner[0][i]) * fx[i];
+			const float d10 = corner[2][i] + (corner[3][i] - corner[2][i]) * fx[i];
+			const float d01 = corner[4][i] + (corner[5][i] - corner[4][i]) * fx[i];
+			const float d11 = corner[6][i] + (corner[7][i] - corner[6][i]) * fx[i];
+			const float d0 = d00 + (d10 - d00) * fy[i];
+			const float d1 = d01 + (d11 - d01) * fy[i];
+			batchDistances[i] = (d0 + (d1 - d0) * fz[i]) * transform->scale;
+
+			const float gx0 = (corner[1][i] - corner[0][i]) + ((corner[3][i] - corner[2][i]) - (corner[1][i] - corner[0][i])) * fy[i];
+			const float gx1 = (corner[5][i] - corner[4][i]) + ((corner[7][i] - corner[6][i]) - (corner[5][i] - corner[4][i])) * fy[i];
+			const float gy0 = (corner[2][i] - corner[0][i]) + ((corner[3][i] - corner[1][i]) - (corner[2][i] - corner[0][i])) * fx[i];
+			const float gy1 = (corner[6][i] - corner[4][i]) + ((corner[7][i] - corner[5][i]) - (corner[6][i] - corner[4][i])) * fx[i];
+			gradients[i] = glm::vec3(gx0 + (gx1 - gx0) * fz[i], gy0 + (gy1 - gy0) * fz[i], d1 - d0);
+		}
+	}
+};
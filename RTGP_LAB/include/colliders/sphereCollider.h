@@ -6,11 +6,24 @@
 class SphereCollider
 {
 private:
+    glm::vec3 previousCenter;
+    bool hasPreviousPose;
 public:
     Transform* transform;
     float radius;
     SphereCollider(Transform* transform, float rad) {
         this->transform = transform;
         this->radius = rad;
+        this->hasPreviousPose = false;
     }; 
-};
\ No newline at end of file
+
+    glm::vec3 Center() const { return transform->translation; }
+    // Center at the end of the previous physics step, used by the continuous collision
+    glm::vec3 PreviousCenter() const { return hasPreviousPose ? previousCenter : transform->translation; }
+
+    // Called after each physics step: the movement until the next step is swept
+    void StorePose(){
+        previousCenter = transform->translation;
+        hasPreviousPose = true;
+    }
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <utils/particle.h>
+
+/*
+	Dihedral bending constraint on two triangles sharing the edge p1-p2
+	(Mueller et al. 2007, "Position Based Dynamics", Appendix A)
+
+		  p3
+		 /  \
+		p1---p2
+		 \  /
+		  p4
+
+	The angle between the normals of (p1,p2,p3) and (p1,p2,p4) is kept at its rest value.
+	It replaces the long range springs (constraint level > 1) used to give stiffness to the cloth
+*/
+class BendingConstraint
+{
+private:
+	float restAngle;
+
+	static float CurrentCosAngle(const glm::vec3 &e, const glm::vec3 &a, const glm::vec3 &b, glm::vec3 &n1, glm::vec3 &n2, float &l1, float &l2)
+	{
+		n1 = glm::cross(e, a);
+		n2 = glm::cross(e, b);
+		l1 = glm::length(n1);
+		l2 = glm::length(n2);
+		if(l1 < 1e-8f || l2 < 1e-8f)
+			return 1.0f;
+		n1 /= l1;
+		n2 /= l2;
+		return glm::clamp(glm::dot(n1, n2), -1.0f, 1.0f);
+	}
+
+public:
+	Particle *p1, *p2, *p3, *p4;
+
+	BendingConstraint(Particle *p1, Particle *p2, Particle *p3, Particle *p4) : p1(p1), p2(p2), p3(p3), p4(p4)
+	{
+		glm::vec3 n1, n2;
+		float l1, l2;
+		restAngle = glm::acos(CurrentCosAngle(p2->pos - p1->pos, p3->pos - p1->pos, p4->pos - p1->pos, n1, n2, l1, l2));
+	}
+	BendingConstraint(Particle *p1, Particle *p2, Particle *p3, Particle *p4, float rest) : restAngle(rest), p1(p1), p2(p2), p3(p3), p4(p4)
+	{
+	}
+
+	float getRestAngle() const { return restAngle; }
+
+	bool Uses(const Particle *p) const { return p1 == p || p2 == p || p3 == p || p4 == p; }
+
+	void satisfyBendingConstraint(float stiffness)
+	{
+		// positions relative to p1
+		const glm::vec3 e = p2->pos - p1->pos;
+		const glm::vec3 a = p3->pos - p1->pos;
+		const glm::vec3 b = p4->pos - p1->pos;
+
+		glm::vec3 n1, n2;
+		float l1, l2;
+		const float d = CurrentCosAngle(e, a, b, n1, n2, l1, l2);
+		if(l1 < 1e-8f || l2 < 1e-8f)
+			return;
+
+		const float angleError = glm::acos(d) - restAngle;
+		if(glm::abs(angleError) < 1e-5f)
+			return;
+
+		// gradients of the angle with respect to the four positions
+		const glm::vec3 q3 = (glm::cross(e, n2) + glm::cross(n1, e) * d) / l1;
+		const glm::vec3 q4 = (glm::cross(e, n1) + glm::cross(n2, e) * d) / l2;
+		const glm::vec3 q2 = -(glm::cross(a, n2) + glm::cross(n1, a) * d) / l1
+							 -(glm::cross(b, n1) + glm::cross(n2, b) * d) / l2;
+		const glm::vec3 q1 = -q2 - q3 - q4;
+
+		const float w1 = p1->movable ? 1.0f : 0.0f;
+		const float w2 = p2->movable ? 1.0f : 0.0f;
+		const float w3 = p3->movable ? 1.0f : 0.0f;
+		const float w4 = p4->movable ? 1.0f : 0.0f;
+
+		const float denominator = w1 * glm::dot(q1, q1) + w2 * glm::dot(q2, q2) + w3 * glm::dot(q3, q3) + w4 * glm::dot(q4, q4);
+		if(denominator < 1e-8f)
+			return;
+
+		const float s = -stiffness * glm::sqrt(1.0f - d * d) * angleError / denominator;
+
+		p1->offsetPos(s * w1 * q1);
+		p2->offsetPos(s * w2 * q2);
+		p3->offsetPos(s * w3 * q3);
+		p4->offsetPos(s * w4 * q4);
+	}
+};
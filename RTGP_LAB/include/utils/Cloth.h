@@ -1,24 +1,76 @@
 #pragma once
 
 #include <utils/constraint.h>
+#include <utils/BendingConstraint.h>
+#include <utils/ClothSelfCollision.h>
+#include <utils/ClothBVH.h>
 #include <vector>
 #include <glad/glad.h>
 #include <physicsSimulation/physicsSimulation.h>
-#include <utils/particlesToCut.h>
+#include <utils/TearQueue.h>
+#include <utils/ClothSnapshot.h>
+#include <utils/ClothTopology.h>
+#include <utils/ConstraintIncidence.h>
+#include <utils/ClothIslands.h>
+#include <utils/StreamBuffer.h>
+#include <utils/ClothVertex.h>
 
 // GLFW
 #include <glfw/glfw3.h>
 #include <utils/Transform.h>
 #include <utils/Scene.h>
+#include <utils/mesh.h>
+#include <colliders/ColliderBroadphase.h>
+#include <colliders/ColliderTables.h>
 
 #include <cstdlib>
 #include <random>
 #include <ctime>
 #include <iostream>
+#include <algorithm>
 
 #define FIXED_TIME_STEP (1.0f / 60.0f)
 #define FIXED_TIME_STEP2 (FIXED_TIME_STEP * FIXED_TIME_STEP)
 
+#define TRIANGLE_NOT_DRAWN 0xFFFFFFFFu
+#define INDEX_PATCH_GAP 16	// dirty triangles closer than this are uploaded in the same glBufferSubData
+#define CLOTH_SPARE_FRACTION 4	// one spare particle every 4 of the template, taken by the vertex splits
+#define CLOTH_NO_PARTICLE 0xFFFFFFFFu
+#define CLOTH_STROKE_SAMPLES 8	// rays cast along a cut stroke
+#define CLOTH_BLADE_TOLERANCE 1e-4f	// overlap of the blade triangles of a stroke, a constraint on a seam is still cut
+#define CLOTH_PARALLEL_BATCH 512	// smallest run of a color batch solved by several threads
+
+// All the values needed to build a cloth, used to compare what changed on Rebuild
+struct ClothParameters
+{
+	int dim;
+	float particleDistance;
+	glm::vec3 topLeftPosition;
+	bool pinned;
+	ConstraintType springsType;
+	float K;
+	float U;
+	unsigned int constraintIterations;
+	float gravity;
+	float mass;
+	unsigned int collisionIterations;
+	unsigned int constraintLevel;
+	float cuttingMultiplier;
+	bool bendingConstraints;	// dihedral bending on adjacent triangles, usually with constraintLevel 1
+	float bendingStiffness;
+	bool selfCollision;
+	bool triangleCollision;	// spheres and capsules also against the triangles, for coarse cloths
+};
+
+// A point of the cloth surface found by a ray
+struct ClothRayHit
+{
+	uint32_t particle;		// vertex of the hit triangle nearest to the point
+	uint32_t triangle;		// index of the triangle in the BVH (the drawn triangles)
+	glm::vec3 barycentric;	// weights of the 3 vertices of the triangle
+	glm::vec3 point;		// world space
+	float distance;			// from the ray origin, in world units
+};
 
 class Cloth
 {
@@ -30,17 +82,267 @@ private:
 	float gravityForce;
 	unsigned int constraintLevel;
 	float cuttingDistanceMultiplier;
+	float particleDistance;
+	glm::vec3 topLeftPosition;
+	bool pinned;
+	float mass;
+	bool useBending;
+	float bendingStiffness;
 
 	GLuint VAO;
 	GLuint EBO;
-	GLuint VBO;
+	StreamBuffer vertexStream;	// the render vertices, written once per frame in the next of its segments
+	std::vector<ClothVertex> renderVertices;	// one per particle, packed before the upload
     std::vector<GLuint> indices;
+	std::vector<uint32_t> triangleSlots;	// slot in indices of each template triangle, TRIANGLE_NOT_DRAWN if torn
+	std::vector<uint32_t> dirtySlots;		// slots degenerated by the cuts since the last upload
+	std::vector<GLuint> drawnIndices;		// indices without the degenerate triangles, for the BVH
+	size_t degenerateCount;
+	size_t eboCapacity;						// in indices
 
 	float maxForce;
 	bool hole;
+	bool cuttable;	// value given to the new constraints
+
+	// Constraints and bending constraints of each particle, for the cuts
+	ConstraintIncidence constraintIncidence;
+	ConstraintIncidence bendingIncidence;
+
+	TearQueue tearQueue;	// over-stretched constraints found by the solver, torn by CheckForCuts
+	std::vector<uint32_t> tornPairs;	// 2 particles per drained constraint, the indices change with the removals
+
+	// A tear splits a particle: the triangles and constraints on one side move to a copy of it,
+	// taken from the spare particles allocated after the template ones (the vector never grows)
+	std::vector<GLuint> clothTriangles;			// triangles of the template, with the split particles renamed
+	ConstraintIncidence triangleIncidence;
+	std::vector<uint32_t> particleOrigin;		// template particle of each particle (itself for the unused spares)
+	uint32_t usedSpares;
+	std::vector<unsigned int> patchOffsets;		// patches of the topology plus a last one with the used spares
+	std::vector<unsigned int> patchParticles;
+	std::vector<uint32_t> splitMoved;			// vertices of the moved and of the kept triangles, for TearConstraint
+	std::vector<uint32_t> splitKept;
+
+	ClothIslands islands;	// connected pieces, stepped and put to sleep independently
+
+	// Particle held by the mouse: pinned while dragged, at the distance from the eye where it was picked
+	uint32_t grabbedParticle;	// CLOTH_NO_PARTICLE if none
+	bool grabbedWasMovable;
+	float grabbedDistance;
+	std::vector<uint32_t> strokeConstraints;	// constraints crossed by a cut stroke
+	std::vector<uint32_t> strokePairs;			// 2 particles per crossed constraint that is not a triangle edge
+
+	std::shared_ptr<const ClothTopology> topology;	// shared with the other cloths of the same grid
+	ColliderBroadphase broadphase;	// spheres, capsules and boxes of the scene binned in a hash grid, rebuilt every step
+	ColliderTables colliderTables;	// collider data read by the narrow phase, rebuilt every step
+
+	// Colliders touching the bounds of each patch of the topology, found once per step.
+	// Patch k tests patchColliders[first .. first + planes + spheres + capsules + boxes), planes first
+	struct PatchColliders
+	{
+		glm::vec3 min;		// bounds of the movable particles, empty (min > max) if all are pinned
+		glm::vec3 max;
+		uint32_t first;
+		uint32_t planes;
+		uint32_t spheres;
+		uint32_t capsules;
+		uint32_t boxes;
+	};
+	std::vector<PatchColliders> patchRanges;
+	std::vector<uint32_t> patchColliders;
+	std::vector<uint32_t> patchCandidates;	// COLLIDER_ID of the broadphase colliders near the current patch
+	float patchMargin;	// enlargement of the patch bounds, the particles still move during the iterations
+
+	// Contacts found by the first collision iteration, the next iterations resolve only these
+	// and retest the particles pushed farther than a quarter of patchMargin. The list of the
+	// last step is resolved once at the beginning of the next one (warm start)
+	std::vector<ColliderContact> contacts;
+	std::vector<uint32_t> movedParticles;
+	std::vector<uint32_t> particleStamp;	// == stamp if the particle is already in movedParticles
+	uint32_t stamp;
+	bool selfCollision;
+	ClothSelfCollision selfCollider;
+	bool triangleCollision;
+
+	// Triangle BVH, built lazily on the first query, refitted at most once per step
+	// and rebuilt when the triangles list changes
+	ClothBVH bvh;
+	bool bvhBuildNeeded;
+	bool bvhRefitNeeded;
+
+	void makeConstraint(Particle *p1, Particle *p2, float rest_distance, float cuttingMuliplier, unsigned int level = 1, unsigned int batch = CONSTRAINT_NO_BATCH) {
+		constraints.push_back(Constraint(p1,p2, rest_distance, cuttingDistanceMultiplier, level, batch));
+		constraints.back().cuttable = this->cuttable;
+		constraintIncidence.MarkDirty();
+		islands.MarkDirty();
+	}
+
+	uint32_t IndexOf(const Particle* p) const { return (uint32_t)(p - particles.data()); }
+
+	void UpdateIncidence()
+	{
+		if(constraintIncidence.dirty){
+			constraintIncidence.Build(particles.size(), constraints.size(), [this](size_t c, uint32_t* out){
+				out[0] = IndexOf(constraints[c].p1);
+				out[1] = IndexOf(constraints[c].p2);
+				return 2;
+			});
+		}
+		if(bendingIncidence.dirty){
+			bendingIncidence.Build(particles.size(), bendingConstraints.size(), [this](size_t b, uint32_t* out){
+				out[0] = IndexOf(bendingConstraints[b].p1);
+				out[1] = IndexOf(bendingConstraints[b].p2);
+				out[2] = IndexOf(bendingConstraints[b].p3);
+				out[3] = IndexOf(bendingConstraints[b].p4);
+				return 4;
+			});
+		}
+		if(triangleIncidence.dirty){
+			triangleIncidence.Build(particles.size(), clothTriangles.size() / 3, [this](size_t t, uint32_t* out){
+				out[0] = clothTriangles[t*3];
+				out[1] = clothTriangles[t*3 + 1];
+				out[2] = clothTriangles[t*3 + 2];
+				return 3;
+			});
+		}
+	}
+
+	void UpdateIslands()
+	{
+		if(!islands.dirty)
+			return;
+		selfCollider.MarkDirty();	// every change of the particles goes through the constraints
+		islands.Build(particles, constraints.size(), [this](size_t c, uint32_t* out){
+			out[0] = IndexOf(constraints[c].p1);
+			out[1] = IndexOf(constraints[c].p2);
+			return 2;
+		}, [this](size_t c){ return (uint32_t)constraints[c].batch; }, topology->BatchCount(),
+		bendingConstraints.size(), [this](size_t b, uint32_t* out){
+			out[0] = IndexOf(bendingConstraints[b].p1);
+			out[1] = IndexOf(bendingConstraints[b].p2);
+			out[2] = IndexOf(bendingConstraints[b].p3);
+			out[3] = IndexOf(bendingConstraints[b].p4);
+			return 4;
+		});
+	}
 
-	void makeConstraint(Particle *p1, Particle *p2, float rest_distance, float cuttingMuliplier) {
-		constraints.push_back(Constraint(p1,p2, rest_distance, cuttingDistanceMultiplier));
+	// The picking rays are in world space, the particles in the space of the cloth transform
+	void ToClothSpace(glm::vec3 &point, glm::vec3 &direction) const
+	{
+		if(transform == nullptr)
+			return;
+		const glm::mat4 toCloth = glm::inverse(transform->modelMatrix);
+		point = glm::vec3(toCloth * glm::vec4(point, 1.0f));
+		direction = glm::vec3(toCloth * glm::vec4(direction, 0.0f));
+	}
+
+	// Adds to strokeConstraints the constraints crossing the quad blade (two triangles, cloth space)
+	// among the ones of the triangles near the segment hit0-hit1: a constraint reaches constraintLevel cells
+	void FindCrossedConstraints(const glm::vec3* blade, const glm::vec3 &hit0, const glm::vec3 &hit1)
+	{
+		const ClothBVH &surface = Surface();
+		UpdateIncidence();
+		const float reach = patchMargin * (float)constraintLevel;
+		surface.QueryAABB(glm::min(hit0, hit1) - glm::vec3(reach), glm::max(hit0, hit1) + glm::vec3(reach), [this, &surface, blade](uint32_t t){
+			const GLuint* triangle = surface.Triangle(t);
+			for(int k = 0; k < 3; k++)
+			{
+				const uint32_t p = triangle[k];
+				for(uint32_t i = constraintIncidence.begin[p]; i < constraintIncidence.end[p]; i++)
+				{
+					const uint32_t c = constraintIncidence.slots[i];
+					if(c == INCIDENCE_EMPTY || (!constraints[c].p1->movable && !constraints[c].p2->movable))
+						continue;
+					const glm::vec3 &a = constraints[c].p1->pos, &b = constraints[c].p2->pos;
+					if(SegmentCrossesTriangle(a, b, blade[0], blade[1], blade[2], CLOTH_BLADE_TOLERANCE) ||
+						SegmentCrossesTriangle(a, b, blade[0], blade[2], blade[3], CLOTH_BLADE_TOLERANCE))
+						strokeConstraints.push_back(c);
+				}
+			}
+		});
+	}
+
+	bool IsTriangleEdge(uint32_t a, uint32_t b) const
+	{
+		for(uint32_t i = triangleIncidence.begin[a]; i < triangleIncidence.end[a]; i++)
+		{
+			const uint32_t t = triangleIncidence.slots[i];
+			if(t != INCIDENCE_EMPTY && (clothTriangles[t*3] == b || clothTriangles[t*3 + 1] == b || clothTriangles[t*3 + 2] == b))
+				return true;
+		}
+		return false;
+	}
+
+	void WakeIslandOf(uint32_t p)
+	{
+		UpdateIslands();
+		if(islands.islandOf[p] != ISLAND_NONE)
+			islands.Wake(islands.islandOf[p]);
+	}
+
+	unsigned int PatchCount() const { return (unsigned int)patchOffsets.size() - 1; }
+
+	// The used spares are in the last patch
+	unsigned int PatchOf(uint32_t p) const { return p < topology->ParticleCount() ? topology->particlePatch[p] : PatchCount() - 1; }
+
+	// The spare particles come after the template ones: not movable, not rendered and in no
+	// triangle until a split takes them
+	void ResetSplits()
+	{
+		const uint32_t templateCount = topology->ParticleCount();
+		for(size_t p = templateCount; p < particles.size(); p++){
+			particles[p] = Particle(glm::vec3(0.0f), mass);
+			particles[p].movable = false;
+			particles[p].renderable = false;
+		}
+		particleOrigin.resize(particles.size());
+		for(size_t p = 0; p < particleOrigin.size(); p++)
+			particleOrigin[p] = (uint32_t)p;
+		usedSpares = 0;
+
+		clothTriangles = topology->triangles;	// same size for every template, no reallocation
+		triangleIncidence.MarkDirty();
+		UpdateSparePatch();
+	}
+
+	void UpdateSparePatch()
+	{
+		patchOffsets = topology->patchOffsets;
+		patchParticles.assign(topology->patchParticles.begin(), topology->patchParticles.end());
+		patchParticles.reserve(particles.size());	// the splits append without reallocations
+		for(uint32_t s = 0; s < usedSpares; s++)
+			patchParticles.push_back(topology->ParticleCount() + s);
+		patchOffsets.push_back((unsigned int)patchParticles.size());
+	}
+
+	// Swap-remove: the last constraint takes the place of c
+	void RemoveConstraint(uint32_t c)
+	{
+		const uint32_t last = (uint32_t)constraints.size() - 1;
+		constraintIncidence.Remove(IndexOf(constraints[c].p1), c);
+		constraintIncidence.Remove(IndexOf(constraints[c].p2), c);
+		if(c != last){
+			constraintIncidence.Replace(IndexOf(constraints[last].p1), last, c);
+			constraintIncidence.Replace(IndexOf(constraints[last].p2), last, c);
+			constraints[c] = constraints[last];
+		}
+		constraints.pop_back();
+		islands.MarkDirty();
+	}
+
+	void RemoveBendingConstraint(uint32_t b)
+	{
+		const uint32_t last = (uint32_t)bendingConstraints.size() - 1;
+		const Particle* removed[4] = { bendingConstraints[b].p1, bendingConstraints[b].p2, bendingConstraints[b].p3, bendingConstraints[b].p4 };
+		for(int k = 0; k < 4; k++)
+			bendingIncidence.Remove(IndexOf(removed[k]), b);
+		if(b != last){
+			const Particle* moved[4] = { bendingConstraints[last].p1, bendingConstraints[last].p2, bendingConstraints[last].p3, bendingConstraints[last].p4 };
+			for(int k = 0; k < 4; k++)
+				bendingIncidence.Replace(IndexOf(moved[k]), last, b);
+			bendingConstraints[b] = bendingConstraints[last];
+		}
+		bendingConstraints.pop_back();
+		islands.MarkDirty();
 	}
 
 	glm::vec3 CalculateNormalTriangle(Particle* p1, Particle* p2, Particle* p3){
@@ -105,70 +407,135 @@ private:
 	}
 	void SetUp()
 	{
-		// we create the buffers
+		// we create the buffers, they are reused for all the life of the cloth
         glGenVertexArrays(1, &this->VAO);
-        glGenBuffers(1, &this->VBO);
         glGenBuffers(1, &this->EBO);
         
 		glBindVertexArray(this->VAO);
 
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
-		// Create triangles from grid
+		// Create triangles from grid, the buffer can hold all the triangles of the template
 		MakeTriangleFromGrid();
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), this->indices.data(), GL_STATIC_DRAW);
+		bvhBuildNeeded = true;
+		eboCapacity = glm::max(indices.size(), topology->triangles.size());
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, eboCapacity * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, this->indices.size() * sizeof(GLuint), this->indices.data());
 		UpdateNormals();
-		// we copy data in the VBO - we must set the data dimension, and the pointer to the structure containing the data
-        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
-        glBufferData(GL_ARRAY_BUFFER, this->particles.size() * sizeof(Particle), &this->particles[0], GL_DYNAMIC_DRAW);
-		
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (GLvoid *)offsetof(Particle, pos));
-		
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (GLvoid *)offsetof(Particle, normal));
-	
-		glEnableVertexAttribArray(2);
-		if(springsType == PHYSICAL || springsType == PHYSICAL_ADVANCED){
-			glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (GLvoid *)offsetof(Particle, force));
-		} else {
-			glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (GLvoid *)offsetof(Particle, shader_force));
-		}
+		// the segments of the vertex stream hold a vertex for all the particles (the spares too), the attributes are set once
+		vertexStream.Create(this->particles.size() * sizeof(ClothVertex));
+		SetVertexAttributes();
 
-		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (GLvoid *)offsetof(Particle, color));
-
-		// Note that this is allowed, the call to glVertexAttribPointer registered VBO as the currently bound vertex buffer object so afterwards we can safely unbind
+		// Note that this is allowed, the call to glVertexAttribPointer registered the stream buffer as the currently bound vertex buffer object so afterwards we can safely unbind
         glBindBuffer(GL_ARRAY_BUFFER, 0); 
         // Unbind VAO (it's always a good thing to unbind any buffer/array to prevent strange bugs), remember: do NOT unbind the EBO, keep it bound to this VAO
         glBindVertexArray(0); 
 	}
+	// Rebuild the triangles list and upload it in the existing EBO (no new GL objects).
+	// The EBO is reallocated only when a new template has more triangles
+	void UploadIndices()
+	{
+		MakeTriangleFromGrid();
+		bvhBuildNeeded = true;
+
+		glBindVertexArray(this->VAO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+		if(indices.size() > eboCapacity){
+			eboCapacity = glm::max(indices.size(), topology->triangles.size());
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, eboCapacity * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+		}
+		if(!indices.empty())
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, this->indices.size() * sizeof(GLuint), this->indices.data());
+		glBindVertexArray(0);
+	}
+	// The triangles come from the topology template (with the split particles), the ones with a
+	// removed particle are skipped
 	void MakeTriangleFromGrid(){
 		indices.clear();
-		for(int x = 0; x < dim-1; x++)
+		dirtySlots.clear();
+		degenerateCount = 0;
+		const std::vector<GLuint> &triangles = clothTriangles;
+		triangleSlots.assign(triangles.size() / 3, TRIANGLE_NOT_DRAWN);
+		for(size_t t = 0; t < triangles.size(); t += 3)
 		{
-			for(int y=0; y < dim-1; y++)
+			if(particles[triangles[t]].renderable &&
+				particles[triangles[t+1]].renderable &&
+				particles[triangles[t+2]].renderable)
 			{
-				if(getParticle(x, y, dim)->renderable && 
-					getParticle(x, y+1, dim)->renderable &&
-					getParticle(x+1, y, dim)->renderable)
-				{
-					indices.push_back((x)*dim +y);
-					indices.push_back((x)*dim +(y+1));
-					indices.push_back((x+1)*dim +(y));
-				}
+				triangleSlots[t / 3] = (uint32_t)(indices.size() / 3);
+				indices.push_back(triangles[t]);
+				indices.push_back(triangles[t+1]);
+				indices.push_back(triangles[t+2]);
+			}
+		}
+	}
+	// A cut does not rebuild the list: the triangles of the removed particle collapse on their
+	// first vertex in place (the rasterizer drops them) and their slots are uploaded by PatchIndices
+	void DegenerateTrianglesOf(uint32_t particle)
+	{
+		const std::vector<uint32_t> &vertexTriangles = triangleIncidence.slots;
+		for(uint32_t i = triangleIncidence.begin[particle]; i < triangleIncidence.end[particle]; i++)
+		{
+			if(vertexTriangles[i] == INCIDENCE_EMPTY)
+				continue;
+			const uint32_t slot = triangleSlots[vertexTriangles[i]];
+			if(slot == TRIANGLE_NOT_DRAWN)
+				continue;
+			triangleSlots[vertexTriangles[i]] = TRIANGLE_NOT_DRAWN;
+			indices[slot*3 + 1] = indices[slot*3 + 2] = indices[slot*3];
+			dirtySlots.push_back(slot);
+			degenerateCount++;
+			bvhBuildNeeded = true;
+		}
+	}
+	// Uploads the dirty slots merged in runs. When a quarter of the triangles are degenerate
+	// the list is compacted instead
+	void PatchIndices()
+	{
+		if(dirtySlots.empty())
+			return;
+		if(degenerateCount * 4 > indices.size() / 3){
+			UploadIndices();
+			return;
+		}
 
-				if(getParticle(x+1, y, dim)->renderable && 
-					getParticle(x, y+1, dim)->renderable &&
-					getParticle(x+1, y+1, dim)->renderable)
-				{
-					indices.push_back((x+1)*dim +(y));
-					indices.push_back((x)*dim +(y+1));
-					indices.push_back((x+1)*dim +(y+1));
-				}
+		std::sort(dirtySlots.begin(), dirtySlots.end());
+		glBindVertexArray(this->VAO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+		size_t first = 0;
+		while(first < dirtySlots.size())
+		{
+			size_t last = first;
+			while(last + 1 < dirtySlots.size() && dirtySlots[last + 1] <= dirtySlots[last] + INDEX_PATCH_GAP)
+				last++;
+			const size_t from = (size_t)dirtySlots[first] * 3, count = ((size_t)dirtySlots[last] + 1) * 3 - from;
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, from * sizeof(GLuint), count * sizeof(GLuint), &indices[from]);
+			first = last + 1;
+		}
+		glBindVertexArray(0);
+		dirtySlots.clear();
+	}
+	// The indices of the triangles still drawn
+	const std::vector<GLuint>& DrawnIndices()
+	{
+		if(degenerateCount == 0)
+			return indices;
+		drawnIndices.clear();
+		for(size_t i = 0; i < indices.size(); i += 3)
+		{
+			if(indices[i] != indices[i+1]){
+				drawnIndices.push_back(indices[i]);
+				drawnIndices.push_back(indices[i+1]);
+				drawnIndices.push_back(indices[i+2]);
 			}
 		}
+		return drawnIndices;
 	}
 	void UpdateNormals(){
+		if(!topology->IsGrid() || usedSpares > 0){
+			UpdateNormalsFromAdjacency();
+			return;
+		}
+
 		std::vector<Particle>::iterator particle;
 		for(particle = particles.begin(); particle != particles.end(); particle++)
 		{
@@ -188,31 +555,57 @@ private:
 			}
 		}
 	}
-	void UpdateBuffers(){
-		glBindVertexArray(this->VAO);
-		// glBufferSubData(GL_ARRAY_BUFFER, 0, this->dim * this->dim * sizeof(particles[0]), &particles);
+	// Each particle gathers the normals of its triangles, walking the triangle incidence lists
+	void UpdateNormalsFromAdjacency(){
+		UpdateIncidence();
+		const std::vector<GLuint> &triangles = clothTriangles;
+		const std::vector<uint32_t> &vertexTriangles = triangleIncidence.slots;
 
-		glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
-        glBufferData(GL_ARRAY_BUFFER, this->dim * this->dim * sizeof(Particle), this->particles.data(), GL_DYNAMIC_DRAW);
-		
+		for(size_t p = 0; p < particles.size(); p++)
+		{
+			glm::vec3 normal(0.0f);
+			for(uint32_t i = triangleIncidence.begin[p]; i < triangleIncidence.end[p]; i++)
+			{
+				if(vertexTriangles[i] == INCIDENCE_EMPTY)
+					continue;
+				const unsigned int t = vertexTriangles[i] * 3;
+				Particle* p1 = &particles[triangles[t]];
+				Particle* p2 = &particles[triangles[t+1]];
+				Particle* p3 = &particles[triangles[t+2]];
+				if(p1->renderable && p2->renderable && p3->renderable)
+					normal += CalculateNormalTriangle(p1, p2, p3);
+			}
+			particles[p].normal = normal;
+		}
+	}
+	// Attributes of the VAO, read from segment 0 of the vertex stream (bound to GL_ARRAY_BUFFER):
+	// the draws select the segment with the base vertex
+	void SetVertexAttributes()
+	{
 		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (GLvoid *)offsetof(Particle, pos));
-		
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(ClothVertex), (GLvoid *)offsetof(ClothVertex, pos));
+
 		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (GLvoid *)offsetof(Particle, normal));
+		glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(ClothVertex), (GLvoid *)offsetof(ClothVertex, normal));
 
 		glEnableVertexAttribArray(2);
-		if(springsType == PHYSICAL || springsType == PHYSICAL_ADVANCED){
-			// glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (GLvoid *)offsetof(Particle, force));
-			glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (GLvoid *)offsetof(Particle, shader_force));
-		} else {
-			glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (GLvoid *)offsetof(Particle, shader_force));
+		glVertexAttribPointer(2, 3, GL_HALF_FLOAT, GL_FALSE, sizeof(ClothVertex), (GLvoid *)offsetof(ClothVertex, force));
+	}
+	// Packs the particles in the render vertices and copies them in the next segment of the vertex stream.
+	// A new grid changes the number of particles: the stream is created again and the attributes point to the new buffer
+	void UpdateBuffers(){
+		renderVertices.resize(this->particles.size());
+		for(size_t p = 0; p < this->particles.size(); p++)
+			renderVertices[p].Pack(this->particles[p]);
+
+		const size_t bytes = renderVertices.size() * sizeof(ClothVertex);
+		if(bytes != vertexStream.SegmentSize()){
+			glBindVertexArray(this->VAO);
+			vertexStream.Create(bytes);
+			SetVertexAttributes();
+			glBindVertexArray(0);
 		}
-
-		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (GLvoid *)offsetof(Particle, color));
-
-		glBindVertexArray(0);
+		vertexStream.Write(renderVertices.data(), bytes);
 	}
 	void freeGPUresources()
     {
@@ -221,20 +614,13 @@ private:
         if (VAO)
         {
             glDeleteVertexArrays(1, &this->VAO);
-            glDeleteBuffers(1, &this->VBO);
+            vertexStream.Destroy();
             glDeleteBuffers(1, &this->EBO);
         }
     }
 
 	glm::vec3 FindIndexParticle(Particle* p){
-		int linearizedIndex = -1;
-
-		for(size_t i = 0; i <= particles.capacity() && linearizedIndex == -1; i++ )
-		{							
-			if(&particles[i] == p){
-				linearizedIndex = i;
-			}
-		}
+		const int linearizedIndex = (int)IndexOf(p);
 
 		glm::vec3 index = glm::vec3(-1.0f);
 
@@ -245,43 +631,38 @@ private:
 		return index;
 	}
 	
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-public:
-	int dim; // number of particles in "width" direction
-	// total number of particles is dim*dim
-
-	std::vector<Particle> particles; // all particles that are part of this cloth
-	std::vector<Constraint> constraints; // alle constraints between particles as part of this cloth
-
-	float K;
-	float U;
-	Transform *transform;
-
-	Cloth(int dim, float particleDistance, glm::vec3 topLeftPosition, Transform *t, bool pinned, ConstraintType usePhysicConstraints, float k, float u, unsigned int contraintIt, float gravity, float m, unsigned int collisionIt, unsigned int constraintLevel, float cuttingMultiplier){
-		this->dim = dim;
-		this->transform = t;
-		this->springsType = usePhysicConstraints;
-		this->constraintIterations = contraintIt;
-		this->collisionIterations = collisionIt;
-		this->gravityForce = gravity;
-		this->K = k;
-		this->U = u;
-		this->constraintLevel = constraintLevel;
-		this->cuttingDistanceMultiplier = cuttingMultiplier;
+	void SetSolverParameters(const ClothParameters &parameters)
+	{
+		this->springsType = parameters.springsType;
+		this->K = parameters.K;
+		this->U = parameters.U;
+		this->constraintIterations = parameters.constraintIterations;
+		this->collisionIterations = parameters.collisionIterations;
+		this->gravityForce = parameters.gravity;
+		this->bendingStiffness = parameters.bendingStiffness;
+	}
 
-		maxForce = 0.0f;
-		particles.resize(dim*dim); //I am essentially using this vector as an array with room for num_particles_width*dim particles
-		
-		const glm::vec3 constraintColor (0.259f, 0.541f, 0.259f); 
-		const glm::vec3 springColor (0.259f, 0.651f, 1.0f); 
-		const glm::vec3 springFrictionColor (0.467f, 0.259f, 1.0f); 
+	glm::vec3 SpringsColor() const
+	{
+		switch (springsType)
+		{
+		case ConstraintType::PHYSICAL:
+			return glm::vec3(0.259f, 0.651f, 1.0f);
+		case ConstraintType::PHYSICAL_ADVANCED:
+			return glm::vec3(0.467f, 0.259f, 1.0f);
+		case ConstraintType::POSITIONAL:
+		default:
+			return glm::vec3(0.259f, 0.541f, 0.259f);
+		}
+	}
 
-		glm::vec3 color (0.0f);
+	// creating particles in a grid of particles from (0,0,0) to (width,-height,0)
+	// resize keeps the capacity, so a rebuild with the same or a smaller grid does not allocate.
+	// The spare particles for the splits follow the grid
+	void CreateParticles()
+	{
+		particles.resize(dim*dim + dim*dim / CLOTH_SPARE_FRACTION); //I am essentially using this vector as an array with room for num_particles_width*dim particles
 
-		// creating particles in a grid of particles from (0,0,0) to (width,-height,0)
 		for(int x=0; x < dim; x++)
 		{
 			for(int y=0; y < dim; y++)
@@ -299,55 +680,477 @@ public:
 								topLeftPosition.x - (x * particleDistance),
 								topLeftPosition.x - (x * particleDistance));
 
-				switch (springsType)
-				{
-				case ConstraintType::POSITIONAL:
-					color = constraintColor;
-					break;
-				case ConstraintType::PHYSICAL:
-					color = springColor;
-					break;
-				case ConstraintType::PHYSICAL_ADVANCED:
-					color = springFrictionColor;
-					break;
-				default:
-					break;
+				particles[(x*dim) + y] = Particle(pos, mass); // Linearization of the index, row = X, col = Y and row dimension = dim
+			}
+		}
+
+		PinTopCorners();
+		ResetSplits();
+	}
+
+	// clear keeps the capacity of the vector. The template edges do not know the split particles:
+	// the tears are sewn back first
+	void CreateConstraints()
+	{
+		if(usedSpares > 0){
+			ResetSplits();
+			hole = true;	// the triangles list must be rebuilt
+		}
+		constraints.clear();
+		constraintIncidence.MarkDirty();
+		islands.MarkDirty();
+		tearQueue.Clear();
+
+		for(unsigned int i = 1; i <= this->constraintLevel; i++){
+			AddConstraintsOfLevel(i);
+		}
+	}
+
+	// Add the constraints between particles at distance level in the grid, taken from the topology template,
+	// each with the color batch of its edge. Particles removed by a cut are not connected again
+	void AddConstraintsOfLevel(unsigned int level)
+	{
+		if(topology->constraintLevel < level)
+			topology = ClothTopologyCache::GetInstance()->GetGrid(dim, level);
+
+		const std::vector<TopologyEdge> &edges = topology->edges;
+		const std::vector<unsigned int> &batchOffsets = topology->batchOffsets;
+		const unsigned int first = topology->levelOffsets[level-1];
+		unsigned int batch = (unsigned int)(std::upper_bound(batchOffsets.begin(), batchOffsets.end(), first) - batchOffsets.begin()) - 1;
+		for(unsigned int e = first; e < topology->levelOffsets[level]; e++)
+		{
+			while(batchOffsets[batch + 1] <= e)
+				batch++;
+			Particle* p1 = &particles[edges[e].p1];
+			Particle* p2 = &particles[edges[e].p2];
+			if(!p1->renderable || !p2->renderable)
+				continue;
+
+			makeConstraint(p1, p2, particleDistance * edges[e].restScale, cuttingDistanceMultiplier, level, batch);
+		}
+	}
+
+	// One bending constraint for each pair of adjacent triangles of the topology, the ones
+	// with a removed or a split particle are skipped
+	void CreateBendingConstraints()
+	{
+		bendingConstraints.clear();
+		bendingIncidence.MarkDirty();
+		islands.MarkDirty();
+		if(!useBending)
+			return;
+
+		std::vector<bool> split(usedSpares > 0 ? topology->ParticleCount() : 0, false);
+		for(uint32_t s = 0; s < usedSpares; s++)
+			split[particleOrigin[topology->ParticleCount() + s]] = true;
+
+		const std::vector<unsigned int> &quads = topology->bendingQuads;
+		for(size_t q = 0; q < topology->bendingRestAngles.size(); q++)
+		{
+			Particle* p1 = &particles[quads[q*4]];
+			Particle* p2 = &particles[quads[q*4 + 1]];
+			Particle* p3 = &particles[quads[q*4 + 2]];
+			Particle* p4 = &particles[quads[q*4 + 3]];
+			if(!p1->renderable || !p2->renderable || !p3->renderable || !p4->renderable)
+				continue;
+			if(!split.empty() && (split[quads[q*4]] || split[quads[q*4 + 1]] || split[quads[q*4 + 2]] || split[quads[q*4 + 3]]))
+				continue;
+
+			bendingConstraints.push_back(BendingConstraint(p1, p2, p3, p4, topology->bendingRestAngles[q]));
+		}
+	}
+
+	// Particles closer than this (and not connected) collide: a bit less than the
+	// grid spacing, or than the average edge of a mesh
+	void UpdateSelfCollisionThickness()
+	{
+		if(IsGrid()){
+			selfCollider.thickness = particleDistance * 0.9f;
+			patchMargin = particleDistance;
+			return;
+		}
+
+		float restSum = 0.0f;
+		const unsigned int stretchEdges = topology->levelOffsets[1];
+		for(unsigned int e = 0; e < stretchEdges; e++)
+			restSum += topology->edges[e].restScale;
+		selfCollider.thickness = stretchEdges > 0 ? 0.75f * restSum / stretchEdges : 0.0f;
+		patchMargin = stretchEdges > 0 ? restSum / stretchEdges : 0.0f;
+	}
+
+	// Lock the upper left most three particles and right most three particles
+	void PinTopCorners()
+	{
+		for(int i=0 ; i<3 && i < dim ; i++)
+		{
+			this->particles[0 + i ].movable = !pinned; 
+			this->particles[0 + (dim - 1 -i)].movable = !pinned;
+		}
+	}
+
+	void Init(const ClothParameters &parameters, Transform *t)
+	{
+		this->transform = t;
+		this->dim = parameters.dim;
+		this->particleDistance = parameters.particleDistance;
+		this->topLeftPosition = parameters.topLeftPosition;
+		this->pinned = parameters.pinned;
+		this->mass = parameters.mass;
+		this->constraintLevel = parameters.constraintLevel;
+		this->cuttingDistanceMultiplier = parameters.cuttingMultiplier;
+		this->useBending = parameters.bendingConstraints;
+		this->selfCollision = parameters.selfCollision;
+		this->triangleCollision = parameters.triangleCollision;
+		SetSolverParameters(parameters);
+
+		maxForce = 0.0f;
+		hole = false;
+		cuttable = false;
+		VAO = 0;
+		bvhRefitNeeded = false;
+		stamp = 0;
+		usedSpares = 0;
+		grabbedParticle = CLOTH_NO_PARTICLE;
+
+		topology = ClothTopologyCache::GetInstance()->GetGrid(dim, constraintLevel);
+		CreateParticles();
+		CreateConstraints();
+		CreateBendingConstraints();
+		UpdateSelfCollisionThickness();
+		SetUp();
+	}
+
+	// Bounds of the movable particles of each patch, then the colliders touching them: the planes,
+	// and the spheres, capsules and boxes of the broadphase cells covered by the patch.
+	// Returns the number of patches with at least one collider
+	size_t UpdatePatchColliders()
+	{
+		const unsigned int patchCount = PatchCount();
+		patchRanges.resize(patchCount);
+		patchColliders.clear();
+		size_t touched = 0;
+		for(unsigned int k = 0; k < patchCount; k++)
+		{
+			PatchColliders &range = patchRanges[k];
+			range.first = (uint32_t)patchColliders.size();
+			range.planes = range.spheres = range.capsules = range.boxes = 0;
+
+			glm::vec3 &min = range.min, &max = range.max;
+			min = glm::vec3(FLT_MAX);
+			max = glm::vec3(-FLT_MAX);
+			for(unsigned int i = patchOffsets[k]; i < patchOffsets[k+1]; i++)
+			{
+				const Particle &p = particles[patchParticles[i]];
+				if(p.movable && islands.stepped[patchParticles[i]]){
+					min = glm::min(min, p.pos);
+					max = glm::max(max, p.pos);
 				}
+			}
+			if(min.x > max.x)
+				continue;	// pinned patch
+			min -= glm::vec3(patchMargin);
+			max += glm::vec3(patchMargin);
+
+			for(size_t i = 0; i < colliderTables.planeD.size(); i++)
+				if(colliderTables.PlaneTouches(i, min, max)){ patchColliders.push_back((uint32_t)i); range.planes++; }
+
+			patchCandidates.clear();
+			broadphase.ForEachOverlap(min, max, [this](uint32_t kind, uint32_t index){
+				patchCandidates.push_back(COLLIDER_ID(kind + 1u, index));	// the broadphase kinds start from the spheres
+				return false;
+			});
+			std::sort(patchCandidates.begin(), patchCandidates.end());	// by kind, then in the order of the tables
+			for(size_t c = 0; c < patchCandidates.size(); c++)
+			{
+				const uint32_t kind = patchCandidates[c] >> 30, i = patchCandidates[c] & COLLIDER_INDEX_MASK;
+				if(kind == COLLIDER_SPHERE && colliderTables.SphereTouches(i, min, max)){ patchColliders.push_back(i); range.spheres++; }
+				else if(kind == COLLIDER_CAPSULE && colliderTables.CapsuleTouches(i, min, max)){ patchColliders.push_back(i); range.capsules++; }
+				else if(kind == COLLIDER_BOX && colliderTables.BoxTouches(i, min, max)){ patchColliders.push_back(i); range.boxes++; }
+			}
+			if(range.planes + range.spheres + range.capsules + range.boxes > 0)
+				touched++;
+		}
+		return touched;
+	}
+
+	// The movable particles of a patch, COLLIDER_BATCH_SIZE at a time, against the colliders of the patch
+	void CollidePatch(unsigned int k)
+	{
+		const PatchColliders &range = patchRanges[k];
+		if(range.planes + range.spheres + range.capsules + range.boxes == 0)
+			return;
+
+		uint32_t batch[COLLIDER_BATCH_SIZE];
+		int count = 0;
+		for(unsigned int i = patchOffsets[k]; i < patchOffsets[k+1]; i++)
+		{
+			const uint32_t p = patchParticles[i];
+			if(!particles[p].movable || !islands.stepped[p])
+				continue;
+			batch[count++] = p;
+			if(count == COLLIDER_BATCH_SIZE){
+				CollideWithPatchColliders(k, batch, count);
+				count = 0;
+			}
+		}
+		if(count > 0)
+			CollideWithPatchColliders(k, batch, count);
+	}
+
+	void CollideWithPatchColliders(unsigned int k, const uint32_t* batch, int count)
+	{
+		const PatchColliders &range = patchRanges[k];
+		const uint32_t* planes = &patchColliders[range.first];
+		const uint32_t* spheres = planes + range.planes;
+		const uint32_t* capsules = spheres + range.spheres;
+		const uint32_t* boxes = capsules + range.capsules;
+		colliderTables.CollideBatch(particles, batch, count, planes, range.planes, spheres, range.spheres, capsules, range.capsules,
+									boxes, range.boxes, contacts);
+	}
 
-				particles[(x*dim) + y] = Particle(pos, m, color); // Linearization of the index, row = X, col = Y and row dimension = dim
+	void MarkMoved(uint32_t p, const glm::vec3 &offset)
+	{
+		const float threshold = 0.25f * patchMargin;
+		if(particleStamp[p] != stamp && glm::dot(offset, offset) > threshold * threshold){
+			particleStamp[p] = stamp;
+			movedParticles.push_back(p);
+		}
+	}
+
+	// Resolves the cached contacts, the list is dropped if the cloth or the scene changed
+	void ResolveContacts()
+	{
+		for(size_t c = 0; c < contacts.size(); c++)
+		{
+			ColliderContact &contact = contacts[c];
+			if(contact.particle >= particles.size() || !colliderTables.Exists(contact.collider)){
+				contacts.clear();
+				return;
+			}
+			Particle &p = particles[contact.particle];
+			glm::vec3 pos = p.pos;
+			if(colliderTables.Resolve(contact.collider, pos, contact.normal)){
+				const glm::vec3 offset = pos - p.pos;
+				p.offsetPos(offset);
+				MarkMoved(contact.particle, offset);
 			}
 		}
+	}
 
-		for(int x=0; x < dim; x++)
+	// The particles moved too much by the last contacts or by a field are tested again against
+	// all the colliders of their patch, their contacts are replaced by the new ones
+	void RetestMovedParticles()
+	{
+		if(movedParticles.empty())
+			return;
+
+		size_t kept = 0;
+		for(size_t c = 0; c < contacts.size(); c++)
 		{
-			for(int y=0; y < dim; y++)
+			if(particleStamp[contacts[c].particle] != stamp)
+				contacts[kept++] = contacts[c];
+		}
+		contacts.erase(contacts.begin() + kept, contacts.end());
+
+		for(size_t m = 0; m < movedParticles.size(); m++)
+		{
+			const uint32_t p = movedParticles[m];
+			const unsigned int k = PatchOf(p);
+			const PatchColliders &range = patchRanges[k];
+			if(particles[p].movable && range.planes + range.spheres + range.capsules + range.boxes > 0)
+				CollideWithPatchColliders(k, &p, 1);
+		}
+		movedParticles.clear();
+	}
+
+	// Spheres and capsules against the triangles of the surface, so a collider smaller than the
+	// grid spacing cannot slide between the particles. The closest point of a triangle inside the
+	// collider is pushed out and the correction is split on the three vertices with its barycentric
+	// weights: edge and vertex contacts have zero weight on the other vertices
+	void TriangleCollisions()
+	{
+		const float margin = patchMargin;	// motion since the refit at the beginning of the collision pass
+		for(size_t i = 0; i < colliderTables.sphereR.size(); i++)
+		{
+			const glm::vec3 center(colliderTables.sphereX[i], colliderTables.sphereY[i], colliderTables.sphereZ[i]);
+			const float r = colliderTables.sphereR[i];
+			bvh.QuerySphere(center, r + margin, [this, &center, r](uint32_t triangle, const glm::vec3 &closest){
+				PushTriangle(bvh.Triangle(triangle), closest, center, r);
+			});
+		}
+		for(size_t i = 0; i < colliderTables.capsuleR.size(); i++)
+		{
+			const glm::vec3 a(colliderTables.capsuleAx[i], colliderTables.capsuleAy[i], colliderTables.capsuleAz[i]);
+			const glm::vec3 b = a + glm::vec3(colliderTables.capsuleABx[i], colliderTables.capsuleABy[i], colliderTables.capsuleABz[i]);
+			const float r = colliderTables.capsuleR[i];
+			const glm::vec3 extent(r + margin);
+			bvh.QueryAABB(glm::min(a, b) - extent, glm::max(a, b) + extent, [this, &a, &b, r](uint32_t triangle){
+				const GLuint* v = bvh.Triangle(triangle);
+				glm::vec3 onSegment, onTriangle;
+				ClosestPointsSegmentTriangle(a, b, particles[v[0]].pos, particles[v[1]].pos, particles[v[2]].pos, onSegment, onTriangle);
+				PushTriangle(v, onTriangle, onSegment, r);
+			});
+		}
+	}
+
+	// Moves the point closest of the triangle v to distance r from center
+	void PushTriangle(const GLuint* v, const glm::vec3 &closest, const glm::vec3 &center, float r)
+	{
+		const glm::vec3 d = closest - center;
+		const float distance2 = glm::dot(d, d);
+		if(distance2 >= r * r || distance2 < 1e-12f)
+			return;
+
+		Particle &p0 = particles[v[0]], &p1 = particles[v[1]], &p2 = particles[v[2]];
+		const glm::vec3 w = Barycentric(closest, p0.pos, p1.pos, p2.pos);
+		const glm::vec3 invMass(p0.movable ? 1.0f : 0.0f, p1.movable ? 1.0f : 0.0f, p2.movable ? 1.0f : 0.0f);
+		const float denominator = glm::dot(w * w, invMass);
+		if(denominator < 1e-8f)
+			return;
+
+		// the closest point moves by sum(w_i * correction_i) = r - distance along the normal
+		const float distance = glm::sqrt(distance2);
+		const glm::vec3 correction = d * ((r - distance) / (distance * denominator));
+		p0.offsetPos(correction * (w.x * invMass.x));
+		p1.offsetPos(correction * (w.y * invMass.y));
+		p2.offsetPos(correction * (w.z * invMass.z));
+	}
+
+	// Particles inside the offset of a distance field (SDFCollider) or of a terrain (HeightfieldCollider)
+	// are pushed out along the gradient. The particles in the field bounds (of the patches overlapping them)
+	// are gathered in batches of BatchSize and sampled together
+	template<typename Field, size_t BatchSize>
+	void FieldCollisions(const Field* field)
+	{
+		glm::vec3 boundsMin, boundsMax;
+		field->Bounds(boundsMin, boundsMax);
+
+		glm::vec3 positions[BatchSize];
+		size_t indices[BatchSize];
+
+		size_t count = 0;
+		for(unsigned int k = 0; k < patchRanges.size(); k++)
+		{
+			if(glm::any(glm::lessThan(patchRanges[k].max, boundsMin)) || glm::any(glm::greaterThan(patchRanges[k].min, boundsMax)))
+				continue;
+			for(unsigned int j = patchOffsets[k]; j < patchOffsets[k+1]; j++)
 			{
-				/*
-				// Constraints from top left
-				// * ---
-				// | \
-				// |  \
-				*/
-				for(int i = 1; i <= this->constraintLevel; i++){
-					if(y+i < dim) makeConstraint(getParticle(x, y, dim), getParticle(x, y+i, dim), particleDistance * i, cuttingDistanceMultiplier);
-					if(x+i < dim) makeConstraint(getParticle(x, y, dim), getParticle(x+i, y, dim), particleDistance * i, cuttingDistanceMultiplier);
-					if(y+i < dim && x+i < dim) makeConstraint(getParticle(x, y, dim), 
-																getParticle(x+i, y+i, dim), 
-																particleDistance*glm::sqrt(2.0f) * i, 
-																cuttingDistanceMultiplier);
+				const unsigned int i = patchParticles[j];
+				const glm::vec3 &pos = particles[i].pos;
+				if(!particles[i].movable || !islands.stepped[i] || glm::any(glm::lessThan(pos, boundsMin)) || glm::any(glm::greaterThan(pos, boundsMax)))
+					continue;
+				positions[count] = pos;
+				indices[count] = i;
+				if(++count == BatchSize){
+					FieldCollideBatch<Field, BatchSize>(field, positions, indices, count);
+					count = 0;
 				}
 			}
 		}
+		if(count > 0)
+			FieldCollideBatch<Field, BatchSize>(field, positions, indices, count);
+	}
 
-		if(pinned){
-			// Lock the upper left most three particles and right most three particles
-			for(int i=0 ; i<3 ; i++)
-			{
-				this->particles[0 + i ].makeUnmovable(); 
-				this->particles[0 + (dim - 1 -i)].makeUnmovable();
+	template<typename Field, size_t BatchSize>
+	void FieldCollideBatch(const Field* field, const glm::vec3* positions, const size_t* indices, size_t count)
+	{
+		float distances[BatchSize];
+		glm::vec3 gradients[BatchSize];
+		unsigned char valid[BatchSize];
+		field->SampleBatch(positions, count, distances, gradients, valid);
+		for(size_t k = 0; k < count; k++)
+		{
+			const float length = glm::length(gradients[k]);
+			if(valid[k] && distances[k] < field->offset && length > 1e-8f){
+				const glm::vec3 offset = gradients[k] * ((field->offset - distances[k]) / length);
+				particles[indices[k]].offsetPos(offset);
+				MarkMoved((uint32_t)indices[k], offset);
 			}
 		}
-		
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+public:
+	int dim; // number of particles in "width" direction
+	// total number of particles is dim*dim
+
+	std::vector<Particle> particles; // all particles that are part of this cloth
+	std::vector<Constraint> constraints; // alle constraints between particles as part of this cloth
+	std::vector<BendingConstraint> bendingConstraints; // dihedral constraints between adjacent triangles
+
+	float K;
+	float U;
+	Transform *transform;
+
+	Cloth(int dim, float particleDistance, glm::vec3 topLeftPosition, Transform *t, bool pinned, ConstraintType usePhysicConstraints, float k, float u, unsigned int contraintIt, float gravity, float m, unsigned int collisionIt, unsigned int constraintLevel, float cuttingMultiplier){
+		ClothParameters parameters;
+		parameters.dim = dim;
+		parameters.particleDistance = particleDistance;
+		parameters.topLeftPosition = topLeftPosition;
+		parameters.pinned = pinned;
+		parameters.springsType = usePhysicConstraints;
+		parameters.K = k;
+		parameters.U = u;
+		parameters.constraintIterations = contraintIt;
+		parameters.gravity = gravity;
+		parameters.mass = m;
+		parameters.collisionIterations = collisionIt;
+		parameters.constraintLevel = constraintLevel;
+		parameters.cuttingMultiplier = cuttingMultiplier;
+		parameters.bendingConstraints = false;
+		parameters.bendingStiffness = 0.0f;
+		parameters.selfCollision = false;
+		parameters.triangleCollision = false;
+
+		Init(parameters, t);
+	}
+	Cloth(const ClothParameters &parameters, Transform *t){
+		Init(parameters, t);
+	}
+	// Cloth built from a triangle mesh (e.g. loaded through Model): welded vertices become particles,
+	// edges stretch constraints and opposite vertices of adjacent triangles bending constraints.
+	// dim, particleDistance, topLeftPosition and pinned of the parameters are not used
+	Cloth(const Mesh &mesh, Transform *t, const ClothParameters &parameters, float weldDistance = 1e-5f){
+		this->transform = t;
+		this->dim = 0;
+		this->particleDistance = 1.0f;	// mesh rest lengths are absolute
+		this->topLeftPosition = glm::vec3(0.0f);
+		this->pinned = false;
+		this->mass = parameters.mass;
+		this->constraintLevel = glm::clamp(parameters.constraintLevel, 1u, 2u);
+		this->cuttingDistanceMultiplier = parameters.cuttingMultiplier;
+		this->useBending = parameters.bendingConstraints;
+		this->selfCollision = parameters.selfCollision;
+		this->triangleCollision = parameters.triangleCollision;
+		SetSolverParameters(parameters);
+
+		maxForce = 0.0f;
+		hole = false;
+		cuttable = false;
+		VAO = 0;
+		bvhRefitNeeded = false;
+		stamp = 0;
+		usedSpares = 0;
+		grabbedParticle = CLOTH_NO_PARTICLE;
+
+		std::vector<glm::vec3> meshPositions(mesh.vertices.size());
+		for(size_t v = 0; v < mesh.vertices.size(); v++)
+			meshPositions[v] = mesh.vertices[v].Position;
+
+		std::vector<glm::vec3> weldedPositions;
+		topology = ClothTopology::BuildFromMesh(meshPositions, mesh.indices, weldedPositions, weldDistance);
+
+		particles.resize(weldedPositions.size() + weldedPositions.size() / CLOTH_SPARE_FRACTION);
+		for(size_t p = 0; p < weldedPositions.size(); p++)
+			particles[p] = Particle(weldedPositions[p], mass);
+		ResetSplits();
+
+		CreateConstraints();
+		CreateBendingConstraints();
+		UpdateSelfCollisionThickness();
 		SetUp();
 	}
 	~Cloth()
@@ -355,51 +1158,450 @@ public:
 		freeGPUresources();
 	}
 
-	Particle* getParticle(int x, int y, int rowDim) {return &particles[x*rowDim + y];}
+	// Apply new parameters to the running cloth, reusing the particles, the constraints capacity and the GL objects.
+	// Only what depends on the changed values is regenerated: solver values (K, U, iterations, gravity)
+	// are simply copied, mass, pins, level and bending go through the live setters. A new grid starts from rest
+	void Rebuild(const ClothParameters &parameters)
+	{
+		Release();
+		if(IsGrid()){
+			if(parameters.dim != this->dim ||
+				parameters.particleDistance != this->particleDistance ||
+				parameters.topLeftPosition != this->topLeftPosition)
+			{
+				ResetToRest(parameters);
+				return;
+			}
+			if(parameters.cuttingMultiplier != this->cuttingDistanceMultiplier){
+				// the tearing distance is stored in the constraints
+				this->cuttingDistanceMultiplier = parameters.cuttingMultiplier;
+				CreateConstraints();
+				CreateBendingConstraints();
+			}
+			if(parameters.pinned != this->pinned)
+				SetPinned(parameters.pinned);
+		}
 
-	void PhysicsSteps(Scene* scene)
+		SetSolverParameters(parameters);
+		if(parameters.mass != this->mass)
+			SetMass(parameters.mass);
+		SetConstraintLevel(parameters.constraintLevel);
+		SetBendingConstraints(parameters.bendingConstraints);
+		if(parameters.selfCollision != this->selfCollision)
+			SetSelfCollision(parameters.selfCollision);
+		SetTriangleCollision(parameters.triangleCollision);
+		WakeUp();
+	}
+
+	// A grid cloth goes back to its rest layout (positions, pins, no tears) as a new cloth would,
+	// still reusing the particles, the constraints capacity and the GL objects: only the topology
+	// template is taken again, when the grid changes. A mesh cloth keeps its shape
+	void ResetToRest(const ClothParameters &parameters)
+	{
+		if(!IsGrid()){
+			Rebuild(parameters);
+			return;
+		}
+		Release();
+
+		const bool gridChanged = parameters.dim != this->dim;
+
+		this->dim = parameters.dim;
+		this->particleDistance = parameters.particleDistance;
+		this->topLeftPosition = parameters.topLeftPosition;
+		this->pinned = parameters.pinned;
+		this->mass = parameters.mass;
+		this->cuttingDistanceMultiplier = parameters.cuttingMultiplier;
+		this->constraintLevel = parameters.constraintLevel;
+		this->useBending = parameters.bendingConstraints;
+		this->selfCollision = parameters.selfCollision;
+		this->triangleCollision = parameters.triangleCollision;
+		SetSolverParameters(parameters);
+
+		if(gridChanged)
+			topology = ClothTopologyCache::GetInstance()->GetGrid(dim, constraintLevel);
+		CreateParticles();
+		CreateConstraints();
+		CreateBendingConstraints();
+		UpdateSelfCollisionThickness();
+
+		UploadIndices();
+		hole = false;
+		WakeUp();
+	}
+
+	// Setters applied to the running simulation, the state of the particles is kept
+	void SetSpringsType(ConstraintType type) { this->springsType = type; WakeUp(); }
+	void SetK(float k) { this->K = k; WakeUp(); }
+	void SetU(float u) { this->U = u; WakeUp(); }
+	void SetGravity(float gravity) { this->gravityForce = gravity; WakeUp(); }
+	void SetConstraintIterations(unsigned int iterations) { this->constraintIterations = iterations; }
+	void SetCollisionIterations(unsigned int iterations) { this->collisionIterations = iterations; }
+	void SetMass(float m)
 	{
+		this->mass = m;
 		std::vector<Particle>::iterator particle;
 		for(particle = particles.begin(); particle != particles.end(); particle++)
 		{
-			particle->PhysicStep(); // calculate the position of each particle at the next time step.
+			particle->mass = m;
+		}
+	}
+	// Only the constraints of the added or removed levels are touched
+	void SetConstraintLevel(unsigned int level)
+	{
+		if(level < 1)
+			level = 1;
+		if(!IsGrid() && level > topology->constraintLevel)
+			level = topology->constraintLevel;	// meshes only have stretch and bending
+
+		if(level < this->constraintLevel){
+			constraints.erase(
+				std::remove_if(constraints.begin(), constraints.end(), [level](const Constraint &c){ return c.level > level; }),
+				constraints.end());
+			constraintIncidence.MarkDirty();
+			islands.MarkDirty();
+			tearQueue.Clear();
+		} else if(level > this->constraintLevel && usedSpares > 0){
+			// the new template edges would cross the tears: the cloth is connected again from scratch
+			this->constraintLevel = level;
+			CreateConstraints();
+			CreateBendingConstraints();
+		} else {
+			for(unsigned int i = this->constraintLevel + 1; i <= level; i++){
+				AddConstraintsOfLevel(i);
+			}
+		}
+		this->constraintLevel = level;
+	}
+	void SetBendingStiffness(float stiffness) { this->bendingStiffness = stiffness; WakeUp(); }
+	void SetBendingConstraints(bool enable)
+	{
+		if(enable == this->useBending)
+			return;
+		this->useBending = enable;
+		CreateBendingConstraints();
+	}
+	// Pins or frees the top corners of a grid, the other particles keep their state
+	void SetPinned(bool isPinned)
+	{
+		this->pinned = isPinned;
+		if(IsGrid())
+			PinTopCorners();
+		WakeUp();
+	}
+	void SetSelfCollision(bool enable) { this->selfCollision = enable; selfCollider.MarkDirty(); }
+	void SetTriangleCollision(bool enable) { this->triangleCollision = enable; }
+	void SetCuttable(bool isCuttable)
+	{
+		this->cuttable = isCuttable;
+		for(size_t i = 0; i < constraints.size(); i++){
+			constraints[i].cuttable = isCuttable;
+		}
+	}
+
+	bool IsGrid() const { return topology->IsGrid(); }
+
+	// The triangles of the cloth (the rendered ones) in a BVH up to date with the current positions,
+	// for picking, ray cutting and collisions against the cloth surface
+	const ClothBVH& Surface()
+	{
+		if(hole){
+			UploadIndices();
+			hole = false;
+		}
+		if(bvhBuildNeeded){
+			bvh.Build(particles, DrawnIndices());
+			bvhBuildNeeded = false;
+			bvhRefitNeeded = false;
+		} else if(bvhRefitNeeded){
+			bvh.Refit(particles);
+			bvhRefitNeeded = false;
+		}
+		return bvh;
+	}
+
+	// Closest point of the cloth hit by the world space ray origin + t*direction, t in [0, maxDistance]
+	bool Raycast(const glm::vec3 &origin, const glm::vec3 &direction, ClothRayHit &hit, float maxDistance = FLT_MAX)
+	{
+		const float length = glm::length(direction);
+		if(length < 1e-12f)
+			return false;
+		const glm::vec3 unitDirection = direction / length;
+		glm::vec3 localOrigin = origin, localDirection = unitDirection;
+		ToClothSpace(localOrigin, localDirection);
+
+		ClothBVH::RayHit surfaceHit;
+		if(!Surface().Raycast(localOrigin, localDirection, maxDistance, surfaceHit))
+			return false;
+
+		const GLuint* triangle = bvh.Triangle(surfaceHit.triangle);
+		hit.triangle = surfaceHit.triangle;
+		hit.barycentric = glm::vec3(1.0f - surfaceHit.u - surfaceHit.v, surfaceHit.u, surfaceHit.v);
+		const int nearest = hit.barycentric.x >= hit.barycentric.y ? (hit.barycentric.x >= hit.barycentric.z ? 0 : 2) : (hit.barycentric.y >= hit.barycentric.z ? 1 : 2);
+		hit.particle = triangle[nearest];
+		hit.distance = surfaceHit.t;	// the affine map keeps the ray parameter
+		hit.point = origin + unitDirection * surfaceHit.t;
+		return true;
+	}
+
+	// Pins the particle under the ray, Drag moves it along the next rays at the same distance from their origin
+	bool Grab(const glm::vec3 &origin, const glm::vec3 &direction)
+	{
+		Release();
+		ClothRayHit hit;
+		if(!Raycast(origin, direction, hit))
+			return false;
+		grabbedParticle = hit.particle;
+		grabbedWasMovable = particles[hit.particle].movable;
+		grabbedDistance = hit.distance;
+		particles[hit.particle].movable = false;
+		WakeIslandOf(hit.particle);
+		return true;
+	}
+
+	void Drag(const glm::vec3 &origin, const glm::vec3 &direction)
+	{
+		if(grabbedParticle == CLOTH_NO_PARTICLE)
+			return;
+		Particle &p = particles[grabbedParticle];
+		if(!p.renderable){
+			Release();	// cut away
+			return;
+		}
+		glm::vec3 target = origin + glm::normalize(direction) * grabbedDistance;
+		glm::vec3 unused(0.0f);
+		ToClothSpace(target, unused);
+		p.old_pos = p.pos;	// the last movement is the velocity on release
+		p.pos = target;
+		bvhRefitNeeded = true;
+		WakeIslandOf(grabbedParticle);
+	}
+
+	// Lets the grabbed particle go, or leaves it pinned where it is
+	void Release(bool keepPinned = false)
+	{
+		if(grabbedParticle == CLOTH_NO_PARTICLE)
+			return;
+		if(!keepPinned)
+			particles[grabbedParticle].movable = grabbedWasMovable;
+		WakeIslandOf(grabbedParticle);
+		grabbedParticle = CLOTH_NO_PARTICLE;
+	}
+
+	bool IsGrabbing() const { return grabbedParticle != CLOTH_NO_PARTICLE; }
+
+	// Color of the cloth (uniform clothColor of the shaders), it depends on the springs type
+	glm::vec3 Color() const { return SpringsColor(); }
+
+	// Tears the constraints crossing the surface swept by a stroke from the ray (origin0, direction0)
+	// to the ray (origin1, direction1), e.g. two cursor positions. The stroke is sampled with
+	// CLOTH_STROKE_SAMPLES rays: between two rays of which at least one hits the cloth, the constraints
+	// of the triangles around the two hits are tested against the quad of the rays (a ray missing the
+	// cloth, past its border, takes the distance of the other). The triangle edges are torn first,
+	// splitting their particles; then the other constraints (shear, bend springs) still between the same
+	// two particles are removed: the ones moved to a copy by a split are already on its side.
+	// Returns the number of removed constraints
+	size_t CutStroke(const glm::vec3 &origin0, const glm::vec3 &direction0, const glm::vec3 &origin1, const glm::vec3 &direction1)
+	{
+		glm::vec3 origins[CLOTH_STROKE_SAMPLES + 1], directions[CLOTH_STROKE_SAMPLES + 1];
+		float distances[CLOTH_STROKE_SAMPLES + 1];
+		bool hits[CLOTH_STROKE_SAMPLES + 1];
+		for(int i = 0; i <= CLOTH_STROKE_SAMPLES; i++)
+		{
+			const float f = (float)i / CLOTH_STROKE_SAMPLES;
+			origins[i] = glm::mix(origin0, origin1, f);
+			directions[i] = glm::normalize(glm::mix(glm::normalize(direction0), glm::normalize(direction1), f));
+			ClothRayHit hit;
+			hits[i] = Raycast(origins[i], directions[i], hit);
+			distances[i] = hits[i] ? hit.distance : 0.0f;
+			ToClothSpace(origins[i], directions[i]);
+		}
+
+		strokeConstraints.clear();
+		for(int i = 0; i < CLOTH_STROKE_SAMPLES; i++)
+		{
+			if(!hits[i] && !hits[i+1])
+				continue;
+			const float distance0 = hits[i] ? distances[i] : distances[i+1];
+			const float distance1 = hits[i+1] ? distances[i+1] : distances[i];
+			const float far = 2.0f * glm::max(distance0, distance1);
+			const glm::vec3 blade[4] = { origins[i], origins[i+1], origins[i+1] + directions[i+1] * far, origins[i] + directions[i] * far };
+			FindCrossedConstraints(blade, origins[i] + directions[i] * distance0, origins[i+1] + directions[i+1] * distance1);
+		}
+		if(strokeConstraints.empty())
+			return 0;
+
+		std::sort(strokeConstraints.begin(), strokeConstraints.end());
+		strokeConstraints.erase(std::unique(strokeConstraints.begin(), strokeConstraints.end()), strokeConstraints.end());
+		tornPairs.clear();
+		strokePairs.clear();
+		for(size_t i = 0; i < strokeConstraints.size(); i++)
+		{
+			const uint32_t a = IndexOf(constraints[strokeConstraints[i]].p1), b = IndexOf(constraints[strokeConstraints[i]].p2);
+			std::vector<uint32_t> &pairs = IsTriangleEdge(a, b) ? tornPairs : strokePairs;
+			pairs.push_back(a);
+			pairs.push_back(b);
+		}
+
+		size_t removed = TearPairs();
+		for(size_t i = 0; i < strokePairs.size(); i += 2)
+		{
+			const uint32_t c = FindConstraint(strokePairs[i], strokePairs[i+1]);
+			if(c != INCIDENCE_EMPTY){
+				RemoveConstraint(c);
+				removed++;
+			}
+		}
+		return removed;
+	}
+
+	Particle* getParticle(int x, int y, int rowDim) {return &particles[x*rowDim + y];}
+
+	// Writes only the two particles of the constraint, the tear queue takes pushes from many threads
+	void SatisfyConstraint(uint32_t c)
+	{
+		bool overStretched = false;
+		switch(springsType){
+			case POSITIONAL:
+				overStretched = constraints[c].satisfyPositionalConstraint(K); // satisfy constraint.
+				break;
+			case PHYSICAL:
+				overStretched = constraints[c].satisfyPhysicsConstraint(K); // satisfy constraint.
+				break;
+			case PHYSICAL_ADVANCED:
+				overStretched = constraints[c].satisfyAdvancedPhysicalConstraint(K, U, FIXED_TIME_STEP);
+				break;
+		}
+		if(overStretched)
+			tearQueue.Push(c);
+	}
+
+	void PhysicsSteps(Scene* scene)
+	{
+		UpdateIslands();
+		if(this->collisionIterations > 0){
+			broadphase.Build(scene, COLLISION_OFFSET_MULTIPLIER);
+			colliderTables.Build(scene, COLLISION_OFFSET_MULTIPLIER);
+
+			// a sleeping island is woken by a sphere, capsule or box moving into its bounds
+			for(size_t k = 0; k < islands.Count(); k++)
+			{
+				const ClothIslands::Island &island = islands.islands[k];
+				if(island.sleeping && broadphase.Overlaps(island.min - glm::vec3(patchMargin), island.max + glm::vec3(patchMargin)))
+					islands.Wake(k);
+			}
+		}
+
+		for(size_t p = 0; p < particles.size(); p++)
+		{
+			if(islands.stepped[p])
+				particles[p].PhysicStep(); // calculate the position of each particle at the next time step.
+			else
+				particles[p].RestStep();
 		}
+		bvhRefitNeeded = true;
+
+		if(selfCollision)
+			selfCollider.Update(particles, *topology, particleOrigin);
 		
-		std::vector<Constraint>::iterator constraint;
+		tearQueue.Reserve(constraints.size());
 		for(size_t i=0; i < this->constraintIterations; i++) // iterate over all constraints several times
 		{
-			for(constraint = constraints.begin(); constraint != constraints.end(); constraint++ )
-			{							
-				switch(springsType){
-					case POSITIONAL:
-						constraint->satisfyPositionalConstraint(K); // satisfy constraint.
-						break;
-					case PHYSICAL:
-						constraint->satisfyPhysicsConstraint(K); // satisfy constraint.
-						break;
-					case PHYSICAL_ADVANCED:
-						constraint->satisfyAdvancedPhysicalConstraint(K, U, FIXED_TIME_STEP);
-						break;
+			// every awake island for its own number of iterations
+			for(size_t k = 0; k < islands.Count(); k++)
+			{
+				if(islands.islands[k].sleeping || i >= islands.Iterations(k, constraintIterations))
+					continue;
+
+				// batch after batch: the constraints of a run share no particle, a large run is split between the threads
+				for(uint32_t r = islands.runOffsets[k]; r < islands.runOffsets[k+1]; r++)
+				{
+					const int begin = (int)islands.runs[r], end = (int)islands.runs[r+1];
+#ifdef _OPENMP
+					#pragma omp parallel for if(!islands.runShared[r] && end - begin >= CLOTH_PARALLEL_BATCH)
+#endif
+					for(int j = begin; j < end; j++)
+						SatisfyConstraint(islands.constraints[j]);
+				}
+
+				for(uint32_t j = islands.bendingOffsets[k]; j < islands.bendingOffsets[k+1]; j++)
+				{
+					bendingConstraints[islands.bendingConstraints[j]].satisfyBendingConstraint(bendingStiffness);
 				}
 			}
+
+			if(selfCollision)
+				selfCollider.Solve(particles);
 		}
 
-		for(size_t i = 0; i < this->collisionIterations; i++){
-			for(particle = particles.begin(); particle != particles.end(); particle++)
+		if(this->collisionIterations > 0){
+			// continuous pass: the particles crossed during the step by a moving sphere or
+			// capsule are put back on the side they came from, the iterations below resolve the rest.
+			// Only the patches whose movement overlaps the volume swept by a collider
+			for(unsigned int k = 0; k < PatchCount(); k++)
 			{
-				for(const auto plane : scene->planes){
-					particle->PlaneCollision(plane);
-				}
-				for(const auto sphere : scene->spheres){
-					particle->SphereCollision(sphere);
+				glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+				for(unsigned int i = patchOffsets[k]; i < patchOffsets[k+1]; i++)
+				{
+					const Particle &p = particles[patchParticles[i]];
+					min = glm::min(min, glm::min(p.pos, p.old_pos));
+					max = glm::max(max, glm::max(p.pos, p.old_pos));
 				}
-				for(const auto capsule : scene->capsules){
-					particle->CapsuleCollision(capsule);
+				if(!broadphase.Overlaps(min, max))
+					continue;
+				for(unsigned int i = patchOffsets[k]; i < patchOffsets[k+1]; i++)
+				{
+					Particle* p = &particles[patchParticles[i]];
+					broadphase.Query(p->pos,
+						[p, scene](uint32_t sphere){ p->SweptSphereCollision(scene->spheres[sphere]); },
+						[p, scene](uint32_t capsule){ p->SweptCapsuleCollision(scene->capsules[capsule]); },
+						[](uint32_t){});	// boxes are resolved by the patches only
 				}
 			}
-		}		
+
+			UpdatePatchColliders();
+			if(triangleCollision)
+				Surface();	// refit once, the query radius covers the motion of the iterations
+
+			if(particleStamp.size() != particles.size()){
+				particleStamp.assign(particles.size(), 0);
+				stamp = 0;
+			}
+			stamp++;
+			ResolveContacts();	// warm start with the contacts of the previous step
+			movedParticles.clear();	// the first iteration tests every particle anyway
+			contacts.clear();
+		} else {
+			contacts.clear();
+		}
+
+		for(size_t i = 0; i < this->collisionIterations; i++){
+			stamp++;
+			if(i == 0){
+				// only the patches whose bounds touch a collider, the contacts found are kept
+				for(unsigned int k = 0; k < patchRanges.size(); k++)
+					CollidePatch(k);
+			} else {
+				ResolveContacts();
+			}
+			for(size_t s = 0; s < scene->sdfs.size(); s++)
+				FieldCollisions<SDFCollider, SDF_BATCH_SIZE>(scene->sdfs[s]);
+			for(size_t h = 0; h < scene->heightfields.size(); h++)
+				FieldCollisions<HeightfieldCollider, HEIGHTFIELD_BATCH_SIZE>(scene->heightfields[h]);
+			RetestMovedParticles();
+			if(triangleCollision)
+				TriangleCollisions();
+		}
+
+		islands.UpdateSleep(particles, patchMargin);	// the grid spacing or the average edge
 	}
 
+	// The sleeping islands are stepped again, e.g. after a change of the forces
+	void WakeUp() { islands.WakeAll(); }
+
+	size_t IslandCount() { UpdateIslands(); return islands.Count(); }
+	size_t SleepingIslandCount() const { return islands.SleepingCount(); }
+
 	void AddGravityForce(){
 		glm::vec3 gravityVec = glm::vec3(0.0f, 1.0f * (gravityForce), 0.0f);
 		std::vector<Particle>::iterator particle;
@@ -410,6 +1612,7 @@ public:
 	}
 	void AddRandomIntensityForce(glm::vec3 normalizedDirection, float min, float max)
 	{
+		WakeUp();
 		std::vector<Particle>::iterator particle;
 		glm::vec3 force = glm::normalize(normalizedDirection);
 		srand(time(0));
@@ -423,6 +1626,7 @@ public:
 	}
 	void AddForceToAllParticles(const glm::vec3 forceVector)
 	{
+		WakeUp();
 		std::vector<Particle>::iterator particle;
 		for(particle = particles.begin(); particle != particles.end(); particle++)
 		{
@@ -431,6 +1635,7 @@ public:
 	}
 	void windForce(glm::vec3 direction)
 	{
+		WakeUp();
 		std::vector<Particle>::iterator particle;
 		bool change = false;
 		for(particle = particles.begin(); particle != particles.end(); particle++)
@@ -449,17 +1654,19 @@ public:
 	void Draw()
 	{
 		if(hole){
-			SetUp();
+			UploadIndices();
 			hole = false;
 		} else {
+			PatchIndices();
 		}
 
 		UpdateNormals();
 		UpdateBuffers();
 
 		glBindVertexArray(this->VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+		glDrawElementsBaseVertex(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, (GLint)(vertexStream.Segment() * particles.size()));
 		glBindVertexArray(0);
+		vertexStream.Fence();
 	}
 
 	void ResetShaderForce(){
@@ -486,55 +1693,51 @@ public:
 		}
 	}
 
+	// O(degree of the particle) with the incidence lists
 	void DeleteAllConstraintOfParticle(Particle* pToDelete){
-		bool del = false;
-		for(size_t i = 0;  i < constraints.size(); i++){
-			if(constraints[i].p1->pos.x == pToDelete->pos.x && constraints[i].p1->pos.y == pToDelete->pos.y)
-				del = true;
-			if(constraints[i].p2->pos.x == pToDelete->pos.x && constraints[i].p2->pos.y == pToDelete->pos.y)
-				del = true;
-
-			if(del)
-				constraints.erase(constraints.begin() + i);
-			
-			del = false;
+		UpdateIncidence();
+		const uint32_t index = IndexOf(pToDelete);
+
+		for(uint32_t i = constraintIncidence.begin[index]; i < constraintIncidence.end[index]; i++){
+			if(constraintIncidence.slots[i] != INCIDENCE_EMPTY)
+				RemoveConstraint(constraintIncidence.slots[i]);
+		}
+		for(uint32_t i = bendingIncidence.begin[index]; i < bendingIncidence.end[index]; i++){
+			if(bendingIncidence.slots[i] != INCIDENCE_EMPTY)
+				RemoveBendingConstraint(bendingIncidence.slots[i]);
 		}
 
+		if(pToDelete->renderable)
+			DegenerateTrianglesOf(index);
 		pToDelete->renderable = false;
-		hole = true;
-
-		// for(size_t x = 0; x < particles.size(); x++){
-		// 	for(size_t y = 0; y < particles.size(); y++){
-		// 		if(getParticle(x, y, particles.size()) == pToDelete)
-		// 			particles.erase(particles.begin() + (x*particles.size()+y));
-		// 	}
-		// }
-
-		// std::cout << "Del: " << del << std::endl;
 	}
+
+	// The particle (x, y) and its 8 neighbours inside the grid
 	void CutAHole(unsigned int x, unsigned int y){
-		Particle* pToDelete0 = getParticle(x, y, dim);
-		Particle* pToDelete1 = getParticle(x, y-1, dim);
-		Particle* pToDelete2 = getParticle(x, y+1, dim);
-		Particle* pToDelete3 = getParticle(x+1, y, dim);
-		Particle* pToDelete4 = getParticle(x+1, y+1, dim);
-		Particle* pToDelete5 = getParticle(x+1, y-1, dim);
-		Particle* pToDelete6 = getParticle(x-1, y, dim);
-		Particle* pToDelete7 = getParticle(x-1, y+1, dim);
-		Particle* pToDelete8 = getParticle(x-1, y-1, dim);
-
-		DeleteAllConstraintOfParticle(pToDelete0);
-		DeleteAllConstraintOfParticle(pToDelete1);
-		DeleteAllConstraintOfParticle(pToDelete2);
-		DeleteAllConstraintOfParticle(pToDelete3);
-		DeleteAllConstraintOfParticle(pToDelete4);
-		DeleteAllConstraintOfParticle(pToDelete5);
-		DeleteAllConstraintOfParticle(pToDelete6);
-		DeleteAllConstraintOfParticle(pToDelete7);
-		DeleteAllConstraintOfParticle(pToDelete8);
+		for(int dx = -1; dx <= 1; dx++){
+			for(int dy = -1; dy <= 1; dy++){
+				const int nx = (int)x + dx, ny = (int)y + dy;
+				if(nx >= 0 && ny >= 0 && nx < dim && ny < dim)
+					DeleteAllConstraintOfParticle(getParticle(nx, ny, dim));
+			}
+		}
 	}
 
 	void CutAHole(Particle* p){
+		if(IndexOf(p) >= topology->ParticleCount()){
+			// a split copy: the hole is cut around the particle it comes from
+			DeleteAllConstraintOfParticle(p);
+			p = &particles[particleOrigin[IndexOf(p)]];
+		}
+		if(!IsGrid()){
+			// the particle and its neighbours from the CSR adjacency
+			const unsigned int index = IndexOf(p);
+			for(unsigned int i = topology->adjacencyOffsets[index]; i < topology->adjacencyOffsets[index+1]; i++)
+				DeleteAllConstraintOfParticle(&particles[topology->adjacency[i]]);
+			DeleteAllConstraintOfParticle(p);
+			return;
+		}
+
 		unsigned int x, y;
 
 		glm::vec3 index = FindIndexParticle(p);
@@ -544,22 +1747,337 @@ public:
 		CutAHole( x,  y);
 	}
 
-	void CheckForCuts(){
-		int size = ParticlesToCut::GetInstance()->particles.size();
+	// Copy the current simulation state into the snapshot (no reallocation after the first save)
+	void SaveSnapshot(ClothSnapshot &snapshot)
+	{
+		const size_t particleCount = particles.size();
+		snapshot.dim = this->dim;
+		snapshot.positions.resize(particleCount);
+		snapshot.oldPositions.resize(particleCount);
+		snapshot.pinned.resize(particleCount);
+		snapshot.renderable.resize(particleCount);
+
+		for(size_t i = 0; i < particleCount; i++){
+			snapshot.positions[i] = particles[i].pos;
+			snapshot.oldPositions[i] = particles[i].old_pos;
+			snapshot.pinned[i] = particles[i].movable ? 0 : 1;
+			snapshot.renderable[i] = particles[i].renderable ? 1 : 0;
+		}
+
+		const Particle* first = particles.data();
+		snapshot.constraints.resize(constraints.size());
+		for(size_t i = 0; i < constraints.size(); i++){
+			ConstraintRecord &record = snapshot.constraints[i];
+			record.p1 = (uint32_t)(constraints[i].p1 - first);
+			record.p2 = (uint32_t)(constraints[i].p2 - first);
+			record.restDistance = constraints[i].getRestDistance();
+			record.cuttable = constraints[i].cuttable ? 1 : 0;
+			record.level = (uint8_t)constraints[i].level;
+			record.batch = (uint16_t)constraints[i].batch;
+		}
+
+		snapshot.bendingConstraints.resize(bendingConstraints.size());
+		for(size_t i = 0; i < bendingConstraints.size(); i++){
+			BendingRecord &record = snapshot.bendingConstraints[i];
+			record.p1 = (uint32_t)(bendingConstraints[i].p1 - first);
+			record.p2 = (uint32_t)(bendingConstraints[i].p2 - first);
+			record.p3 = (uint32_t)(bendingConstraints[i].p3 - first);
+			record.p4 = (uint32_t)(bendingConstraints[i].p4 - first);
+			record.restAngle = bendingConstraints[i].getRestAngle();
+		}
 
-		if(size > 0){
+		snapshot.origins = particleOrigin;
+		snapshot.triangles.assign(clothTriangles.begin(), clothTriangles.end());
+	}
+
+	// Copy only the pin flags of the particles and the cuttable flag of the cloth into a snapshot of
+	// this cloth: the flags set by a scene are kept by a later restore, the positions and the tears are not touched
+	void UpdateSnapshotFlags(ClothSnapshot &snapshot) const
+	{
+		if(snapshot.pinned.size() != particles.size())
+			return;
+		for(size_t i = 0; i < particles.size(); i++){
+			const bool movable = i == grabbedParticle ? grabbedWasMovable : particles[i].movable;	// the held particle is pinned only while dragged
+			snapshot.pinned[i] = movable ? 0 : 1;
+		}
+		for(size_t i = 0; i < snapshot.constraints.size(); i++)
+			snapshot.constraints[i].cuttable = this->cuttable ? 1 : 0;
+	}
+
+	// Bring the cloth back to a saved state, the particles and the GL buffers are reused.
+	// Returns false if the snapshot was taken from a cloth with a different grid
+	bool RestoreSnapshot(const ClothSnapshot &snapshot)
+	{
+		if(snapshot.IsEmpty() || snapshot.dim != this->dim || snapshot.positions.size() != particles.size() ||
+			snapshot.origins.size() != particles.size() || snapshot.triangles.size() != clothTriangles.size())
+			return false;
+		for(size_t i = 0; i < snapshot.triangles.size(); i++){
+			if(snapshot.triangles[i] >= particles.size())
+				return false;
+		}
+		for(size_t i = 0; i < snapshot.origins.size(); i++){
+			if(snapshot.origins[i] != i && snapshot.origins[i] >= topology->ParticleCount())
+				return false;
+		}
+		for(size_t i = 0; i < snapshot.constraints.size(); i++){
+			if(snapshot.constraints[i].p1 >= particles.size() || snapshot.constraints[i].p2 >= particles.size())
+				return false;
+			if(snapshot.constraints[i].batch >= topology->BatchCount() && snapshot.constraints[i].batch != CONSTRAINT_NO_BATCH)
+				return false;
+		}
+		for(size_t i = 0; i < snapshot.bendingConstraints.size(); i++){
+			const BendingRecord &record = snapshot.bendingConstraints[i];
+			if(record.p1 >= particles.size() || record.p2 >= particles.size() || record.p3 >= particles.size() || record.p4 >= particles.size())
+				return false;
+		}
+
+		grabbedParticle = CLOTH_NO_PARTICLE;	// the pinned flags come from the snapshot
+		for(size_t i = 0; i < particles.size(); i++){
+			Particle &p = particles[i];
+			bool renderable = snapshot.renderable[i] != 0;
+			if(p.renderable != renderable)
+				hole = true;	// the triangles list must be rebuilt
+
+			p.pos = snapshot.positions[i];
+			p.old_pos = snapshot.oldPositions[i];
+			p.movable = snapshot.pinned[i] == 0;
+			p.renderable = renderable;
+			p.resetForce();
+			p.shader_force = glm::vec3(0.0f);
+		}
+		bvhRefitNeeded = true;
+
+		// the split particles: the spares are taken in order, the used ones have another origin
+		particleOrigin = snapshot.origins;
+		usedSpares = 0;
+		while(topology->ParticleCount() + usedSpares < particles.size() && particleOrigin[topology->ParticleCount() + usedSpares] < topology->ParticleCount())
+			usedSpares++;
+		UpdateSparePatch();
+		if(!std::equal(clothTriangles.begin(), clothTriangles.end(), snapshot.triangles.begin())){
+			clothTriangles.assign(snapshot.triangles.begin(), snapshot.triangles.end());
+			triangleIncidence.MarkDirty();
 			hole = true;
-			std::cout << "Capacity: " << size << std::endl;
+		}
+
+		constraints.clear();	// keeps the capacity
+		constraintIncidence.MarkDirty();
+		islands.MarkDirty();
+		unsigned int maxLevel = 1;
+		for(size_t i = 0; i < snapshot.constraints.size(); i++){
+			const ConstraintRecord &record = snapshot.constraints[i];
+			constraints.push_back(Constraint(&particles[record.p1], &particles[record.p2], record.restDistance, cuttingDistanceMultiplier, record.level, record.batch));
+			constraints.back().cuttable = record.cuttable != 0;
+			maxLevel = glm::max(maxLevel, (unsigned int)record.level);
+		}
+		this->constraintLevel = maxLevel;
+
+		bendingConstraints.clear();
+		bendingIncidence.MarkDirty();
+		for(size_t i = 0; i < snapshot.bendingConstraints.size(); i++){
+			const BendingRecord &record = snapshot.bendingConstraints[i];
+			bendingConstraints.push_back(BendingConstraint(&particles[record.p1], &particles[record.p2], &particles[record.p3], &particles[record.p4], record.restAngle));
+		}
+		this->useBending = !bendingConstraints.empty();
+
+		tearQueue.Clear();
+		return true;
+	}
+
+	bool SaveSnapshotToFile(const std::string &path)
+	{
+		ClothSnapshot snapshot;
+		SaveSnapshot(snapshot);
+		return snapshot.WriteToFile(path);
+	}
+
+	bool LoadSnapshotFromFile(const std::string &path)
+	{
+		ClothSnapshot snapshot;
+		if(!snapshot.ReadFromFile(path))
+			return false;
+		return RestoreSnapshot(snapshot);
+	}
+
+	// The constraint between the particles a and b, INCIDENCE_EMPTY if they are not connected
+	uint32_t FindConstraint(uint32_t a, uint32_t b)
+	{
+		UpdateIncidence();
+		for(uint32_t i = constraintIncidence.begin[a]; i < constraintIncidence.end[a]; i++)
+		{
+			const uint32_t c = constraintIncidence.slots[i];
+			if(c != INCIDENCE_EMPTY && (IndexOf(constraints[c].p1) == b || IndexOf(constraints[c].p2) == b))
+				return c;
+		}
+		return INCIDENCE_EMPTY;
+	}
 
-			for(int i = 0; i < size; i++){
-				Particle* pToCut = ParticlesToCut::GetInstance()->particles[i];
-				CutAHole(pToCut);
-				std::cout << "Cutting " << std::endl;
+	// Removes the constraint c and splits its movable particle v along the plane through v orthogonal
+	// to the constraint. The triangles of v on the side of the other particle (by their centroid) move
+	// to a spare copy of v, with the constraints and bending constraints of v on that side: the edges
+	// shared by the two sides are kept on both copies, the bending constraints across them are removed.
+	// Without spares left, or with all the triangles on one side, the constraint is only removed
+	void TearConstraint(uint32_t c)
+	{
+		UpdateIncidence();
+		Particle* a = constraints[c].p1;
+		Particle* b = constraints[c].p2;
+		if(!a->movable && !b->movable)
+			return;
+		const uint32_t v = IndexOf(a->movable ? a : b);
+		const glm::vec3 origin = particles[v].pos;
+		const glm::vec3 normal = (a->movable ? b : a)->pos - origin;
+		RemoveConstraint(c);
+
+		const uint32_t spare = topology->ParticleCount() + usedSpares;
+		if(spare >= particles.size() || !particles[v].renderable)
+			return;
+
+		auto movesTriangle = [this, &origin, &normal](uint32_t t){
+			const glm::vec3 centroid = (particles[clothTriangles[t*3]].pos + particles[clothTriangles[t*3 + 1]].pos + particles[clothTriangles[t*3 + 2]].pos) / 3.0f;
+			return glm::dot(centroid - origin, normal) > 0.0f;
+		};
+		splitMoved.clear();
+		splitKept.clear();
+		for(uint32_t i = triangleIncidence.begin[v]; i < triangleIncidence.end[v]; i++)
+		{
+			const uint32_t t = triangleIncidence.slots[i];
+			if(t == INCIDENCE_EMPTY)
+				continue;
+			std::vector<uint32_t> &side = movesTriangle(t) ? splitMoved : splitKept;
+			for(int k = 0; k < 3; k++)
+				if(clothTriangles[t*3 + k] != v)
+					side.push_back(clothTriangles[t*3 + k]);
+		}
+		if(splitMoved.empty() || splitKept.empty())
+			return;
+
+		// 1 moved side, -1 kept side, 0 both (the vertices of the edges shared by the two sides).
+		// The particles in no triangle of v are placed by their position
+		auto sideOf = [this, v, &origin, &normal](const Particle* p){
+			const uint32_t index = IndexOf(p);
+			const bool moved = std::find(splitMoved.begin(), splitMoved.end(), index) != splitMoved.end();
+			const bool kept = std::find(splitKept.begin(), splitKept.end(), index) != splitKept.end();
+			if(moved || kept)
+				return moved && kept ? 0 : (moved ? 1 : -1);
+			return glm::dot(p->pos - origin, normal) > 0.0f ? 1 : -1;
+		};
+
+		Particle* from = &particles[v];
+		Particle* copy = &particles[spare];
+		*copy = *from;
+		particleOrigin[spare] = particleOrigin[v];
+		usedSpares++;
+		patchParticles.push_back(spare);
+		patchOffsets.back()++;
+
+		// with no degenerate triangles the BVH triangles are the slots: renamed in place, no rebuild or refit
+		const bool patchSurface = bvh.IsBuilt() && !bvhBuildNeeded && degenerateCount == 0;
+
+		for(uint32_t i = triangleIncidence.begin[v]; i < triangleIncidence.end[v]; i++)
+		{
+			const uint32_t t = triangleIncidence.slots[i];
+			if(t == INCIDENCE_EMPTY || !movesTriangle(t))
+				continue;
+			const uint32_t slot = triangleSlots[t];
+			for(int k = 0; k < 3; k++)
+			{
+				if(clothTriangles[t*3 + k] != v)
+					continue;
+				clothTriangles[t*3 + k] = spare;
+				if(slot != TRIANGLE_NOT_DRAWN)
+					indices[slot*3 + k] = spare;
 			}
+			if(slot != TRIANGLE_NOT_DRAWN){
+				dirtySlots.push_back(slot);
+				if(patchSurface)
+					bvh.SetTriangle(slot, &indices[slot*3]);
+			}
+			triangleIncidence.slots[i] = INCIDENCE_EMPTY;
+			triangleIncidence.Add(spare, t);
+		}
+		if(!patchSurface)
+			bvhBuildNeeded = true;	// patched: the copy is where the particle is, the boxes do not change
 
-			ParticlesToCut::GetInstance()->particles.clear();
+		for(uint32_t i = constraintIncidence.begin[v]; i < constraintIncidence.end[v]; i++)
+		{
+			const uint32_t k = constraintIncidence.slots[i];
+			if(k == INCIDENCE_EMPTY)
+				continue;
+			Constraint constraint = constraints[k];
+			Particle* &endpoint = constraint.p1 == from ? constraint.p1 : constraint.p2;
+			const int side = sideOf(constraint.p1 == from ? constraint.p2 : constraint.p1);
+			if(side < 0)
+				continue;
+			endpoint = copy;
+			if(side == 0){
+				constraint.batch = CONSTRAINT_NO_BATCH;	// shares the other particle with the original, of the same batch
+				constraints.push_back(constraint);
+				constraintIncidence.Add(IndexOf(constraint.p1), (uint32_t)constraints.size() - 1);
+				constraintIncidence.Add(IndexOf(constraint.p2), (uint32_t)constraints.size() - 1);
+			} else {
+				constraints[k] = constraint;
+				constraintIncidence.slots[i] = INCIDENCE_EMPTY;
+				constraintIncidence.Add(spare, k);
+			}
 		}
 
+		for(uint32_t i = bendingIncidence.begin[v]; i < bendingIncidence.end[v]; i++)
+		{
+			const uint32_t k = bendingIncidence.slots[i];
+			if(k == INCIDENCE_EMPTY)
+				continue;
+			BendingConstraint &bending = bendingConstraints[k];
+			Particle** quad[4] = { &bending.p1, &bending.p2, &bending.p3, &bending.p4 };
+			bool moved = false, kept = false;
+			for(int q = 0; q < 4; q++)
+			{
+				if(*quad[q] == from)
+					continue;
+				const int side = sideOf(*quad[q]);
+				moved = moved || side > 0;
+				kept = kept || side < 0;
+			}
+			if(moved && kept){
+				RemoveBendingConstraint(k);	// hinge on the tear
+			} else if(moved){
+				for(int q = 0; q < 4; q++)
+					if(*quad[q] == from)
+						*quad[q] = copy;
+				bendingIncidence.slots[i] = INCIDENCE_EMPTY;
+				bendingIncidence.Add(spare, k);
+			}
+		}
+	}
 
+	// Tears the constraints queued by the solver, splitting their particles.
+	// The queue is drained before any constraint is removed, the indices are still valid
+	void CheckForCuts(){
+		if(tearQueue.Size() == 0)
+			return;
+
+		tornPairs.clear();
+		tearQueue.Drain([this](uint32_t c){
+			if(c >= constraints.size())
+				return;
+			tornPairs.push_back(IndexOf(constraints[c].p1));
+			tornPairs.push_back(IndexOf(constraints[c].p2));
+		});
+
+		TearPairs();
+	}
+
+	// Tears the constraints between the particles of tornPairs, returns how many were found
+	size_t TearPairs()
+	{
+		size_t torn = 0;
+		for(size_t i = 0; i < tornPairs.size(); i += 2)
+		{
+			const uint32_t c = FindConstraint(tornPairs[i], tornPairs[i+1]);
+			if(c != INCIDENCE_EMPTY){
+				TearConstraint(c);
+				torn++;
+			}
+		}
+		return torn;
 	}
 };
\ No newline at end of file
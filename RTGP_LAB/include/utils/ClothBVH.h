@@ -0,0 +1,325 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glad/glad.h>
+#include <utils/particle.h>
+#include <utils/Geometry.h>
+
+#include <vector>
+#include <cstdint>
+#include <cfloat>
+#include <algorithm>
+
+#define CLOTH_BVH_LEAF_SIZE 4
+
+/*
+	Bounding volume hierarchy over the triangles of a cloth.
+	The tree is built once from the triangle list (median split on the longest axis) and then,
+	while the cloth deforms, only the boxes are refitted bottom-up: the nodes are grouped
+	by depth and every depth is refitted in parallel (OpenMP), from the deepest to the root.
+	A rebuild is needed only when the triangles change (a cut).
+
+	Queries: ray (closest hit), sphere and axis aligned box (every overlapping triangle)
+*/
+class ClothBVH
+{
+private:
+	struct Node
+	{
+		glm::vec3 min;
+		glm::vec3 max;
+		uint32_t left;		// internal node: children left and right; leaf: triangles [first, first + count)
+		uint32_t right;
+		uint32_t first;
+		uint32_t count;		// 0 for the internal nodes
+	};
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> triangleOrder;	// triangles sorted by leaf
+	std::vector<uint32_t> nodesByDepth;		// nodes of depth d are nodesByDepth[depthOffsets[d] .. depthOffsets[d+1])
+	std::vector<uint32_t> depthOffsets;
+	std::vector<GLuint> triangles;			// 3 particle indices per triangle
+	const std::vector<Particle>* particles;
+	float margin;
+
+	glm::vec3 Vertex(uint32_t triangle, int k) const { return (*particles)[triangles[triangle*3 + k]].pos; }
+
+	void TriangleBounds(uint32_t triangle, glm::vec3 &min, glm::vec3 &max) const
+	{
+		const glm::vec3 a = Vertex(triangle, 0), b = Vertex(triangle, 1), c = Vertex(triangle, 2);
+		min = glm::min(glm::min(a, b), c);
+		max = glm::max(glm::max(a, b), c);
+	}
+
+	void RefitNode(uint32_t n)
+	{
+		Node &node = nodes[n];
+		if(node.count > 0){
+			node.min = glm::vec3(FLT_MAX);
+			node.max = glm::vec3(-FLT_MAX);
+			for(uint32_t i = node.first; i < node.first + node.count; i++)
+			{
+				glm::vec3 tMin, tMax;
+				TriangleBounds(triangleOrder[i], tMin, tMax);
+				node.min = glm::min(node.min, tMin);
+				node.max = glm::max(node.max, tMax);
+			}
+			node.min -= glm::vec3(margin);
+			node.max += glm::vec3(margin);
+		} else {
+			node.min = glm::min(nodes[node.left].min, nodes[node.right].min);
+			node.max = glm::max(nodes[node.left].max, nodes[node.right].max);
+		}
+	}
+
+	// Builds the subtree of triangleOrder[first, first + count), returns the index of its root
+	uint32_t BuildNode(uint32_t first, uint32_t count, uint32_t depth, std::vector<glm::vec3> &centroids, std::vector<uint32_t> &depths)
+	{
+		const uint32_t n = (uint32_t)nodes.size();
+		nodes.push_back(Node());
+		depths.push_back(depth);
+		nodes[n].first = first;
+		nodes[n].count = count;
+
+		if(count <= CLOTH_BVH_LEAF_SIZE)
+			return n;
+
+		glm::vec3 cMin(FLT_MAX), cMax(-FLT_MAX);
+		for(uint32_t i = first; i < first + count; i++)
+		{
+			cMin = glm::min(cMin, centroids[triangleOrder[i]]);
+			cMax = glm::max(cMax, centroids[triangleOrder[i]]);
+		}
+		const glm::vec3 extent = cMax - cMin;
+		const int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+
+		const uint32_t half = count / 2;
+		std::nth_element(triangleOrder.begin() + first, triangleOrder.begin() + first + half, triangleOrder.begin() + first + count,
+			[&centroids, axis](uint32_t a, uint32_t b){ return centroids[a][axis] < centroids[b][axis]; });
+
+		const uint32_t left = BuildNode(first, half, depth + 1, centroids, depths);
+		const uint32_t right = BuildNode(first + half, count - half, depth + 1, centroids, depths);
+		nodes[n].left = left;
+		nodes[n].right = right;
+		nodes[n].count = 0;
+		return n;
+	}
+
+	static bool Overlap(const Node &node, const glm::vec3 &min, const glm::vec3 &max)
+	{
+		return node.min.x <= max.x && node.max.x >= min.x &&
+				node.min.y <= max.y && node.max.y >= min.y &&
+				node.min.z <= max.z && node.max.z >= min.z;
+	}
+
+	// Slab test, returns the entry distance or FLT_MAX
+	static float RayBox(const Node &node, const glm::vec3 &origin, const glm::vec3 &invDirection, float maxT)
+	{
+		const glm::vec3 t1 = (node.min - origin) * invDirection;
+		const glm::vec3 t2 = (node.max - origin) * invDirection;
+		const glm::vec3 tMin = glm::min(t1, t2);
+		const glm::vec3 tMax = glm::max(t1, t2);
+		const float enter = glm::max(glm::max(tMin.x, tMin.y), glm::max(tMin.z, 0.0f));
+		const float exit = glm::min(glm::min(tMax.x, tMax.y), glm::min(tMax.z, maxT));
+		return enter <= exit ? enter : FLT_MAX;
+	}
+
+	// Moller-Trumbore ray/triangle intersection
+	bool RayTriangle(uint32_t triangle, const glm::vec3 &origin, const glm::vec3 &direction, float &t, float &u, float &v) const
+	{
+		const glm::vec3 a = Vertex(triangle, 0);
+		const glm::vec3 e1 = Vertex(triangle, 1) - a;
+		const glm::vec3 e2 = Vertex(triangle, 2) - a;
+		const glm::vec3 p = glm::cross(direction, e2);
+		const float det = glm::dot(e1, p);
+		if(glm::abs(det) < 1e-12f)
+			return false;
+		const float invDet = 1.0f / det;
+		const glm::vec3 s = origin - a;
+		u = glm::dot(s, p) * invDet;
+		if(u < 0.0f || u > 1.0f)
+			return false;
+		const glm::vec3 q = glm::cross(s, e1);
+		v = glm::dot(direction, q) * invDet;
+		if(v < 0.0f || u + v > 1.0f)
+			return false;
+		t = glm::dot(e2, q) * invDet;
+		return t >= 0.0f;
+	}
+
+public:
+	struct RayHit
+	{
+		uint32_t triangle;	// index in the triangle list given to Build
+		float t;			// distance along the ray (in units of the direction length)
+		float u, v;			// barycentric coordinates of the hit: p = (1-u-v)*v0 + u*v1 + v*v2
+	};
+
+	ClothBVH() : particles(nullptr), margin(0.0f) {}
+
+	bool IsBuilt() const { return !nodes.empty(); }
+	size_t TriangleCount() const { return triangles.size() / 3; }
+	// particle indices of a triangle
+	const GLuint* Triangle(uint32_t triangle) const { return &triangles[triangle * 3]; }
+
+	// Builds the tree from scratch, the triangle list is copied (3 particle indices per triangle).
+	// boxMargin enlarges all the boxes (e.g. the cloth thickness)
+	void Build(const std::vector<Particle> &clothParticles, const std::vector<GLuint> &triangleList, float boxMargin = 0.0f)
+	{
+		particles = &clothParticles;
+		triangles = triangleList;
+		margin = boxMargin;
+		nodes.clear();
+		const uint32_t triangleCount = (uint32_t)(triangles.size() / 3);
+		if(triangleCount == 0){
+			nodesByDepth.clear();
+			depthOffsets.clear();
+			return;
+		}
+
+		std::vector<glm::vec3> centroids(triangleCount);
+		triangleOrder.resize(triangleCount);
+		for(uint32_t t = 0; t < triangleCount; t++)
+		{
+			centroids[t] = (Vertex(t, 0) + Vertex(t, 1) + Vertex(t, 2)) / 3.0f;
+			triangleOrder[t] = t;
+		}
+
+		std::vector<uint32_t> depths;
+		nodes.reserve(2 * (triangleCount / CLOTH_BVH_LEAF_SIZE + 1));
+		BuildNode(0, triangleCount, 0, centroids, depths);
+
+		// counting sort of the nodes by depth, used by the parallel refit
+		uint32_t maxDepth = 0;
+		for(size_t n = 0; n < depths.size(); n++)
+			maxDepth = glm::max(maxDepth, depths[n]);
+		depthOffsets.assign(maxDepth + 2, 0);
+		for(size_t n = 0; n < depths.size(); n++)
+			depthOffsets[depths[n] + 1]++;
+		for(uint32_t d = 0; d <= maxDepth; d++)
+			depthOffsets[d + 1] += depthOffsets[d];
+		nodesByDepth.resize(nodes.size());
+		std::vector<uint32_t> cursor(depthOffsets.begin(), depthOffsets.end() - 1);
+		for(size_t n = 0; n < depths.size(); n++)
+			nodesByDepth[cursor[depths[n]]++] = (uint32_t)n;
+
+		Refit(clothParticles);
+	}
+
+	// Renames the particles of a triangle (a vertex split): the tree is kept, Refit updates the boxes
+	void SetTriangle(uint32_t triangle, const GLuint* vertices)
+	{
+		triangles[triangle*3] = vertices[0];
+		triangles[triangle*3 + 1] = vertices[1];
+		triangles[triangle*3 + 2] = vertices[2];
+	}
+
+	// Updates the boxes to the current positions, the tree structure is kept. O(n)
+	void Refit(const std::vector<Particle> &clothParticles)
+	{
+		particles = &clothParticles;
+		if(nodes.empty())
+			return;
+
+		for(int d = (int)depthOffsets.size() - 2; d >= 0; d--)
+		{
+			const int begin = (int)depthOffsets[d];
+			const int end = (int)depthOffsets[d + 1];
+#ifdef _OPENMP
+			#pragma omp parallel for if(end - begin > 256)
+#endif
+			for(int i = begin; i < end; i++)
+				RefitNode(nodesByDepth[i]);
+		}
+	}
+
+	// Closest triangle hit by the ray origin + t*direction, t in [0, maxT]
+	bool Raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxT, RayHit &hit) const
+	{
+		if(nodes.empty())
+			return false;
+
+		const glm::vec3 invDirection = 1.0f / direction;	// infinities are handled by the slab test
+		hit.t = maxT;
+		bool found = false;
+
+		uint32_t stack[64];
+		int top = 0;
+		stack[top++] = 0;
+		while(top > 0)
+		{
+			const Node &node = nodes[stack[--top]];
+			if(RayBox(node, origin, invDirection, hit.t) == FLT_MAX)
+				continue;
+
+			if(node.count > 0){
+				for(uint32_t i = node.first; i < node.first + node.count; i++)
+				{
+					float t, u, v;
+					if(RayTriangle(triangleOrder[i], origin, direction, t, u, v) && t <= hit.t){
+						hit.triangle = triangleOrder[i];
+						hit.t = t;
+						hit.u = u;
+						hit.v = v;
+						found = true;
+					}
+				}
+			} else {
+				// nearest child last, so it is visited first
+				const float tLeft = RayBox(nodes[node.left], origin, invDirection, hit.t);
+				const float tRight = RayBox(nodes[node.right], origin, invDirection, hit.t);
+				if(tLeft < tRight){
+					if(tRight != FLT_MAX) stack[top++] = node.right;
+					stack[top++] = node.left;
+				} else {
+					if(tLeft != FLT_MAX) stack[top++] = node.left;
+					if(tRight != FLT_MAX) stack[top++] = node.right;
+				}
+			}
+		}
+		return found;
+	}
+
+	// Calls f(triangle) for every triangle whose box overlaps [min, max]
+	template<typename F>
+	void QueryAABB(const glm::vec3 &min, const glm::vec3 &max, F f) const
+	{
+		if(nodes.empty())
+			return;
+
+		uint32_t stack[64];
+		int top = 0;
+		stack[top++] = 0;
+		while(top > 0)
+		{
+			const Node &node = nodes[stack[--top]];
+			if(!Overlap(node, min, max))
+				continue;
+
+			if(node.count > 0){
+				for(uint32_t i = node.first; i < node.first + node.count; i++)
+				{
+					glm::vec3 tMin, tMax;
+					TriangleBounds(triangleOrder[i], tMin, tMax);
+					if(tMax.x >= min.x && tMin.x <= max.x && tMax.y >= min.y && tMin.y <= max.y && tMax.z >= min.z && tMin.z <= max.z)
+						f(triangleOrder[i]);
+				}
+			} else {
+				stack[top++] = node.left;
+				stack[top++] = node.right;
+			}
+		}
+	}
+
+	// Calls f(triangle, closestPoint) for every triangle closer than radius to center
+	template<typename F>
+	void QuerySphere(const glm::vec3 &center, float radius, F f) const
+	{
+		QueryAABB(center - glm::vec3(radius), center + glm::vec3(radius), [this, &center, radius, &f](uint32_t triangle){
+			const glm::vec3 closest = ClosestPointOnTriangle(center, Vertex(triangle, 0), Vertex(triangle, 1), Vertex(triangle, 2));
+			const glm::vec3 d = closest - center;
+			if(glm::dot(d, d) <= radius * radius)
+				f(triangle, closest);
+		});
+	}
+};
@@ -0,0 +1,292 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <utils/particle.h>
+
+#include <vector>
+#include <cstdint>
+#include <cfloat>
+#include <cmath>
+
+#define ISLAND_NONE 0xFFFFFFFFu
+#define ISLAND_SLEEP_STEPS 60			// steps below the sleep distance before an island sleeps
+#define ISLAND_SLEEP_FRACTION 0.005f	// largest movement of a particle in a step to be at rest, in particle spacings
+
+/*
+	Connected pieces of a cloth: union-find over the live constraints and bending constraints,
+	rebuilt when they change (a tear, a new constraint level, a snapshot). The removed particles
+	(not renderable and without constraints) are in no island.
+	Particles, constraints and bending constraints are grouped by island in CSR form, in their
+	original order; the constraints of an island are also sorted by color batch and split in runs
+	of one batch, solved in parallel when no particle repeats in the run. Every island has its bounds, its sleep state and an iteration budget: the
+	solver converges in a number of iterations proportional to the diameter of the piece, so an
+	island gets the iterations of the largest one scaled by the square root of the size ratio.
+	A sleeping island is not stepped until woken
+*/
+class ClothIslands
+{
+private:
+	std::vector<uint32_t> parent;
+	std::vector<uint32_t> cursor;
+	std::vector<uint32_t> byBatch;		// constraints sorted by batch
+	std::vector<uint32_t> batchCursor;
+	std::vector<uint32_t> runOfParticle;	// last run touching each particle
+
+	uint32_t Find(uint32_t p)
+	{
+		while(parent[p] != p){
+			parent[p] = parent[parent[p]];	// path halving
+			p = parent[p];
+		}
+		return p;
+	}
+
+	void Union(uint32_t a, uint32_t b)
+	{
+		a = Find(a);
+		b = Find(b);
+		if(a != b)
+			parent[glm::max(a, b)] = glm::min(a, b);	// the root is the smallest particle, the ids follow the particle order
+	}
+
+	// counting sort of the items by island: offsets has one entry more than the islands.
+	// The items are taken in the given order (nullptr for 0 .. itemCount-1), kept inside an island
+	template<typename IslandOfItem>
+	void Group(size_t itemCount, const uint32_t* order, IslandOfItem islandOfItem, std::vector<uint32_t> &offsets, std::vector<uint32_t> &items)
+	{
+		offsets.assign(islands.size() + 1, 0);
+		for(size_t i = 0; i < itemCount; i++)
+		{
+			const uint32_t k = islandOfItem(order != nullptr ? order[i] : i);
+			if(k != ISLAND_NONE)
+				offsets[k + 1]++;
+		}
+		for(size_t k = 0; k < islands.size(); k++)
+			offsets[k + 1] += offsets[k];
+
+		cursor.assign(offsets.begin(), offsets.end() - 1);
+		items.resize(offsets.back());
+		for(size_t i = 0; i < itemCount; i++)
+		{
+			const uint32_t item = order != nullptr ? order[i] : (uint32_t)i;
+			const uint32_t k = islandOfItem(item);
+			if(k != ISLAND_NONE)
+				items[cursor[k]++] = item;
+		}
+	}
+
+	// counting sort of the constraints by batch, the ones without a batch last
+	template<typename ConstraintBatch>
+	void SortByBatch(size_t constraintCount, ConstraintBatch constraintBatch, uint32_t batchCount)
+	{
+		batchCursor.assign(batchCount + 2, 0);
+		for(size_t c = 0; c < constraintCount; c++)
+			batchCursor[glm::min(constraintBatch(c), batchCount) + 1]++;
+		for(uint32_t b = 0; b <= batchCount; b++)
+			batchCursor[b + 1] += batchCursor[b];
+		byBatch.resize(constraintCount);
+		for(size_t c = 0; c < constraintCount; c++)
+			byBatch[batchCursor[glm::min(constraintBatch(c), batchCount)]++] = (uint32_t)c;
+	}
+
+public:
+	struct Island
+	{
+		glm::vec3 min;
+		glm::vec3 max;
+		uint32_t stillSteps;	// consecutive steps at rest
+		bool sleeping;
+	};
+
+	std::vector<Island> islands;
+	std::vector<uint32_t> islandOf;			// ISLAND_NONE for the removed particles
+	std::vector<uint8_t> stepped;			// 1 if the particle is in an awake island
+	std::vector<uint32_t> particleOffsets;	// the particles of island k are particles[particleOffsets[k] .. particleOffsets[k+1])
+	std::vector<uint32_t> particles;
+	std::vector<uint32_t> constraintOffsets;
+	std::vector<uint32_t> constraints;		// by island, inside an island by batch
+	std::vector<uint32_t> runOffsets;		// the runs of island k are runs[runOffsets[k] .. runOffsets[k+1])
+	std::vector<uint32_t> runs;				// run r is constraints[runs[r] .. runs[r+1]), one more entry at the end
+	std::vector<uint8_t> runShared;			// 1 if a particle repeats in the run (or no batch): solved in order
+	std::vector<uint32_t> bendingOffsets;
+	std::vector<uint32_t> bendingConstraints;
+	uint32_t largest;						// particles of the largest island
+	bool dirty;
+
+	ClothIslands() : largest(0), dirty(true) {}
+
+	void MarkDirty() { dirty = true; }
+
+	// constraintParticles(c, out) and bendingParticles(b, out) write the particles of the constraint
+	// in out and return how many they are, as for ConstraintIncidence. constraintBatch(c) is the color
+	// batch of a constraint, batchCount or more if it has none. The islands are all awake after a build
+	template<typename ConstraintParticles, typename ConstraintBatch, typename BendingParticles>
+	void Build(const std::vector<Particle> &cloth, size_t constraintCount, ConstraintParticles constraintParticles,
+				ConstraintBatch constraintBatch, uint32_t batchCount, size_t bendingCount, BendingParticles bendingParticles)
+	{
+		const size_t n = cloth.size();
+		parent.resize(n);
+		for(size_t p = 0; p < n; p++)
+			parent[p] = (uint32_t)p;
+
+		stepped.assign(n, 0);	// here 1 if the particle has a constraint
+		uint32_t ends[4];
+		for(size_t c = 0; c < constraintCount; c++)
+		{
+			const int count = constraintParticles(c, ends);
+			for(int k = 0; k < count; k++){
+				Union(ends[0], ends[k]);
+				stepped[ends[k]] = 1;
+			}
+		}
+		for(size_t b = 0; b < bendingCount; b++)
+		{
+			const int count = bendingParticles(b, ends);
+			for(int k = 0; k < count; k++){
+				Union(ends[0], ends[k]);
+				stepped[ends[k]] = 1;
+			}
+		}
+
+		// the roots come before their particles: one pass numbers the islands
+		islands.clear();
+		islandOf.assign(n, ISLAND_NONE);
+		for(size_t p = 0; p < n; p++)
+		{
+			if(!cloth[p].renderable && !stepped[p])
+				continue;
+			const uint32_t root = Find((uint32_t)p);
+			if(root == p){
+				islandOf[p] = (uint32_t)islands.size();
+				islands.push_back({ glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX), 0, false });
+			} else {
+				islandOf[p] = islandOf[root];
+			}
+		}
+
+		Group(n, nullptr, [this](size_t p){ return islandOf[p]; }, particleOffsets, particles);
+		SortByBatch(constraintCount, constraintBatch, batchCount);
+		Group(constraintCount, byBatch.data(), [this, &constraintParticles, &ends](size_t c){ constraintParticles(c, ends); return islandOf[ends[0]]; }, constraintOffsets, constraints);
+		Group(bendingCount, nullptr, [this, &bendingParticles, &ends](size_t b){ bendingParticles(b, ends); return islandOf[ends[0]]; }, bendingOffsets, bendingConstraints);
+
+		// runs of one batch inside each island, checked for repeated particles
+		runOffsets.assign(islands.size() + 1, 0);
+		runs.clear();
+		runShared.clear();
+		runOfParticle.assign(n, ISLAND_NONE);
+		for(size_t k = 0; k < islands.size(); k++)
+		{
+			runOffsets[k] = (uint32_t)runs.size();
+			uint32_t batch = 0;
+			for(uint32_t i = constraintOffsets[k]; i < constraintOffsets[k+1]; i++)
+			{
+				const uint32_t b = glm::min(constraintBatch(constraints[i]), batchCount);
+				if(i == constraintOffsets[k] || b != batch){
+					runs.push_back(i);
+					runShared.push_back(b == batchCount ? 1 : 0);
+					batch = b;
+				}
+				const uint32_t run = (uint32_t)runs.size() - 1;
+				const int count = constraintParticles(constraints[i], ends);
+				for(int e = 0; e < count; e++){
+					if(runOfParticle[ends[e]] == run)
+						runShared[run] = 1;
+					runOfParticle[ends[e]] = run;
+				}
+			}
+		}
+		runOffsets[islands.size()] = (uint32_t)runs.size();
+		runs.push_back((uint32_t)constraints.size());
+
+		largest = 0;
+		for(size_t k = 0; k < islands.size(); k++)
+			largest = glm::max(largest, particleOffsets[k+1] - particleOffsets[k]);
+		for(size_t p = 0; p < n; p++)
+			stepped[p] = islandOf[p] != ISLAND_NONE ? 1 : 0;
+		UpdateBounds(cloth);
+		dirty = false;
+	}
+
+	size_t Count() const { return islands.size(); }
+
+	size_t SleepingCount() const
+	{
+		size_t sleeping = 0;
+		for(size_t k = 0; k < islands.size(); k++)
+			sleeping += islands[k].sleeping ? 1 : 0;
+		return sleeping;
+	}
+
+	// sqrt(size / largest) of maxIterations, at least one
+	unsigned int Iterations(size_t k, unsigned int maxIterations) const
+	{
+		const float ratio = (float)(particleOffsets[k+1] - particleOffsets[k]) / (float)glm::max(largest, 1u);
+		return glm::clamp((unsigned int)std::ceil(maxIterations * std::sqrt(ratio)), 1u, glm::max(maxIterations, 1u));
+	}
+
+	void UpdateBounds(const std::vector<Particle> &cloth)
+	{
+		for(size_t k = 0; k < islands.size(); k++)
+		{
+			Island &island = islands[k];
+			island.min = glm::vec3(FLT_MAX);
+			island.max = glm::vec3(-FLT_MAX);
+			for(uint32_t i = particleOffsets[k]; i < particleOffsets[k+1]; i++)
+			{
+				island.min = glm::min(island.min, cloth[particles[i]].pos);
+				island.max = glm::max(island.max, cloth[particles[i]].pos);
+			}
+		}
+	}
+
+	// After a step: bounds of the awake islands and their rest counters.
+	// An island at rest for ISLAND_SLEEP_STEPS steps falls asleep with zero velocity
+	void UpdateSleep(std::vector<Particle> &cloth, float spacing)
+	{
+		const float rest = ISLAND_SLEEP_FRACTION * spacing;
+		for(size_t k = 0; k < islands.size(); k++)
+		{
+			Island &island = islands[k];
+			if(island.sleeping)
+				continue;
+
+			float movement2 = 0.0f;
+			island.min = glm::vec3(FLT_MAX);
+			island.max = glm::vec3(-FLT_MAX);
+			for(uint32_t i = particleOffsets[k]; i < particleOffsets[k+1]; i++)
+			{
+				const Particle &p = cloth[particles[i]];
+				const glm::vec3 d = p.pos - p.old_pos;
+				movement2 = glm::max(movement2, glm::dot(d, d));
+				island.min = glm::min(island.min, p.pos);
+				island.max = glm::max(island.max, p.pos);
+			}
+
+			island.stillSteps = movement2 < rest * rest ? island.stillSteps + 1 : 0;
+			if(island.stillSteps < ISLAND_SLEEP_STEPS)
+				continue;
+			island.sleeping = true;
+			for(uint32_t i = particleOffsets[k]; i < particleOffsets[k+1]; i++)
+			{
+				cloth[particles[i]].old_pos = cloth[particles[i]].pos;
+				stepped[particles[i]] = 0;
+			}
+		}
+	}
+
+	void Wake(size_t k)
+	{
+		if(!islands[k].sleeping)
+			return;
+		islands[k].sleeping = false;
+		islands[k].stillSteps = 0;
+		for(uint32_t i = particleOffsets[k]; i < particleOffsets[k+1]; i++)
+			stepped[particles[i]] = 1;
+	}
+
+	void WakeAll()
+	{
+		for(size_t k = 0; k < islands.size(); k++)
+			Wake(k);
+	}
+};
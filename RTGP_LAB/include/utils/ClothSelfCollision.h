@@ -0,0 +1,314 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <utils/particle.h>
+#include <utils/ClothTopology.h>
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+
+#define SELF_COLLISION_MAX_PAIRS_PER_PARTICLE 8
+#define SELF_COLLISION_SEARCH_RADIUS 1.5f	// in thickness units, the skin keeps the pairs for several steps
+#define SELF_COLLISION_MAX_DRIFT 0.15f		// in thickness units, drift of a particle since the search
+#define SELF_COLLISION_SEARCH_INTERVAL 8	// steps between two searches at most
+
+/*
+	Particle-particle self collision of a cloth.
+	The particles are sorted in a spatial hash with a counting sort, then the particles of each
+	cell look for particles closer than the search radius in their own cell and in the 13 "forward"
+	cells around it (the other 13 are covered by the particles of those cells), so each pair is
+	found once. Topological neighbours (level 1 edges) are skipped, they are kept at their
+	distance by the constraints.
+	The pairs closer than the thickness plus a margin are then projected at thickness distance
+	inside the solver loop, like the other position constraints.
+
+	A search costs about as much as the rest of a step, so the pairs are kept for
+	SELF_COLLISION_SEARCH_INTERVAL steps: the search radius has a skin of half the thickness for the
+	particles that move closer in the meantime. After the interval the search is redone only if a
+	particle drifted more than SELF_COLLISION_MAX_DRIFT, the common motion of the cloth removed,
+	so a resting or falling cloth keeps its pairs. Tears, splits and restores search again at once.
+	Vertex-triangle tests are not done: a query of the triangle BVH for every particle costs many
+	times a step.
+
+	Hashing and pair search are parallel (OpenMP, /openmp), the counting sort and the
+	projection are serial. Each particle stores its pairs in fixed slots, so the
+	result does not depend on the threads order
+*/
+class ClothSelfCollision
+{
+private:
+	// everything a candidate needs together, it costs a single cache line read
+	struct SortedParticle
+	{
+		glm::vec3 pos;
+		uint32_t index;
+		glm::ivec3 cell;
+		uint32_t origin;
+	};
+
+	float cellSize;
+	uint32_t tableMask;
+
+	std::vector<glm::vec3> searchPositions;	// positions at the last search
+	float searchThickness;
+	unsigned int stepsSinceSearch;
+	bool dirty;
+
+	std::vector<glm::ivec3> particleCell;
+	std::vector<uint32_t> particleBucket;	// bucket of each particle
+	std::vector<uint32_t> bucketStart;		// particles of bucket b are sorted[bucketStart[b] .. bucketStart[b+1])
+	std::vector<SortedParticle> sorted;
+	std::vector<uint32_t> pairSlots;		// SELF_COLLISION_MAX_PAIRS_PER_PARTICLE per particle
+	std::vector<uint32_t> pairCount;
+
+	static uint32_t NextPowerOfTwo(uint32_t v)
+	{
+		uint32_t p = 1;
+		while(p < v)
+			p <<= 1;
+		return p;
+	}
+
+	glm::ivec3 Cell(const glm::vec3 &pos) const
+	{
+		return glm::ivec3((int)std::floor(pos.x / cellSize), (int)std::floor(pos.y / cellSize), (int)std::floor(pos.z / cellSize));
+	}
+
+	// Additive, the hash of a neighbour cell is the hash of the cell plus the hash of the offset
+	static uint32_t Hash(const glm::ivec3 &cell)
+	{
+		return (uint32_t)cell.x * 73856093u + (uint32_t)cell.y * 19349663u + (uint32_t)cell.z * 83492791u;
+	}
+
+	// Offsets of the own cell (c = 0) and of the 13 neighbour cells lexicographically after it:
+	// the 27 cells around are numbered 0..26 from (-1,-1,-1), the own cell is 13
+	static glm::ivec3 ForwardOffset(int c)
+	{
+		const int m = 13 + c;
+		return glm::ivec3(m / 9 - 1, (m / 3) % 3 - 1, m % 3 - 1);
+	}
+
+	// On the template particles: the copies made by the tears are neighbours of their
+	// origin's neighbours, and of each other
+	static bool AreNeighbours(const ClothTopology &topology, uint32_t a, uint32_t b)
+	{
+		if(a == b)
+			return true;
+		for(unsigned int i = topology.adjacencyOffsets[a]; i < topology.adjacencyOffsets[a+1]; i++)
+		{
+			if(topology.adjacency[i] == b)
+				return true;
+		}
+		return false;
+	}
+
+	// A particle drifted from the last search more than the skin allows, the common motion removed
+	bool Drifted(const std::vector<Particle> &particles) const
+	{
+		glm::vec3 mean(0.0f);
+		size_t count = 0;
+		for(size_t i = 0; i < particles.size(); i++)
+		{
+			if(particles[i].renderable){
+				mean += particles[i].pos - searchPositions[i];
+				count++;
+			}
+		}
+		if(count == 0)
+			return false;
+		mean /= (float)count;
+
+		const float maxDrift = thickness * SELF_COLLISION_MAX_DRIFT;
+		for(size_t i = 0; i < particles.size(); i++)
+		{
+			const glm::vec3 drift = particles[i].pos - searchPositions[i] - mean;
+			if(particles[i].renderable && glm::dot(drift, drift) > maxDrift * maxDrift)
+				return true;
+		}
+		return false;
+	}
+
+public:
+	float thickness;	// minimum distance between two particles that are not neighbours
+	std::vector<uint32_t> pairs;	// 2 indices per pair
+	std::vector<uint32_t> activePairs;	// the pairs projected in this step
+
+	ClothSelfCollision() : cellSize(1.0f), tableMask(0), searchThickness(0.0f), stepsSinceSearch(0), dirty(true), thickness(0.1f) {}
+
+	// The particles changed (tears, splits, restores): the pairs are searched again
+	void MarkDirty() { dirty = true; }
+
+	// Once per step, after the integration
+	void Update(const std::vector<Particle> &particles, const ClothTopology &topology, const std::vector<uint32_t> &origins)
+	{
+		stepsSinceSearch++;
+		if(dirty || searchThickness != thickness || searchPositions.size() != particles.size() ||
+			(stepsSinceSearch >= SELF_COLLISION_SEARCH_INTERVAL && Drifted(particles)))
+			FindPairs(particles, topology, origins);
+
+		// a bit more than the thickness, the particles still move during the solver iterations
+		const float activeDistance = thickness * 1.2f;
+		activePairs.clear();
+		for(size_t k = 0; k < pairs.size(); k += 2)
+		{
+			const glm::vec3 d = particles[pairs[k+1]].pos - particles[pairs[k]].pos;
+			if(glm::dot(d, d) < activeDistance * activeDistance){
+				activePairs.push_back(pairs[k]);
+				activePairs.push_back(pairs[k+1]);
+			}
+		}
+	}
+
+	// origins[i] is the template particle of particle i (i itself if it was not split)
+	void FindPairs(const std::vector<Particle> &particles, const ClothTopology &topology, const std::vector<uint32_t> &origins)
+	{
+		const int n = (int)particles.size();
+		pairs.clear();
+		stepsSinceSearch = 0;
+		dirty = false;
+		searchThickness = thickness;
+		searchPositions.resize(n);
+		for(int i = 0; i < n; i++)
+			searchPositions[i] = particles[i].pos;
+		if(n == 0 || thickness <= 0.0f){
+			dirty = true;	// no hash to query
+			return;
+		}
+
+		// the skin covers twice the drift allowed before the next search, the margin of the active pairs remains
+		const float searchRadius = thickness * SELF_COLLISION_SEARCH_RADIUS;
+		const float searchRadius2 = searchRadius * searchRadius;
+		cellSize = searchRadius;
+		tableMask = NextPowerOfTwo((uint32_t)n * 2) - 1;
+
+		particleCell.resize(n);
+		particleBucket.resize(n);
+#ifdef _OPENMP
+		#pragma omp parallel for
+#endif
+		for(int i = 0; i < n; i++)
+		{
+			particleCell[i] = Cell(particles[i].pos);
+			particleBucket[i] = Hash(particleCell[i]) & tableMask;
+		}
+
+		// counting sort of the particles by bucket. The removed particles and the unused spares
+		// are left out: they all lie in a few cells and every query would scan them
+		bucketStart.assign(tableMask + 2, 0);
+		for(int i = 0; i < n; i++)
+		{
+			if(particles[i].renderable)
+				bucketStart[particleBucket[i] + 1]++;
+		}
+		for(uint32_t b = 0; b <= tableMask; b++)
+			bucketStart[b + 1] += bucketStart[b];
+		const uint32_t sortedCount = bucketStart[tableMask + 1];
+		sorted.resize(sortedCount);
+		pairCount.assign(bucketStart.begin(), bucketStart.end() - 1);	// used as fill cursor
+		for(int i = 0; i < n; i++)
+		{
+			if(!particles[i].renderable)
+				continue;
+			const uint32_t k = pairCount[particleBucket[i]]++;
+			sorted[k].pos = particles[i].pos;
+			sorted[k].index = (uint32_t)i;
+			sorted[k].cell = particleCell[i];
+			sorted[k].origin = origins[i];
+		}
+
+		pairSlots.resize((size_t)n * SELF_COLLISION_MAX_PAIRS_PER_PARTICLE);
+		pairCount.assign(n, 0);
+
+		uint32_t forwardHash[14];
+		for(int c = 0; c < 14; c++)
+			forwardHash[c] = Hash(ForwardOffset(c));
+
+		// Cell by cell: the particles of a cell read the 14 buckets together. A bucket can hold
+		// other cells too, the candidates are checked on their cell so each pair is found once
+#ifdef _OPENMP
+		#pragma omp parallel for schedule(dynamic, 64)
+#endif
+		for(int bucket = 0; bucket <= (int)tableMask; bucket++)
+		{
+			const uint32_t bucketEnd = bucketStart[bucket + 1];
+			for(uint32_t first = bucketStart[bucket]; first < bucketEnd; )
+			{
+				// the run of particles of the same cell
+				const glm::ivec3 cell = sorted[first].cell;
+				uint32_t last = first + 1;
+				while(last < bucketEnd && sorted[last].cell == cell)
+					last++;
+
+				// the 14 cells read by all the particles of the run
+				const uint32_t hash = Hash(cell);
+				uint32_t rangeBegin[14], rangeEnd[14];
+				for(int c = 0; c < 14; c++)
+				{
+					const uint32_t otherBucket = (hash + forwardHash[c]) & tableMask;
+					rangeBegin[c] = bucketStart[otherBucket];
+					rangeEnd[c] = bucketStart[otherBucket + 1];
+				}
+
+				for(uint32_t s = first; s < last; s++)
+				{
+					const uint32_t i = sorted[s].index;
+					const glm::vec3 pos = sorted[s].pos;
+					const uint32_t origin = sorted[s].origin;
+					uint32_t* slots = &pairSlots[(size_t)i * SELF_COLLISION_MAX_PAIRS_PER_PARTICLE];
+					uint32_t found = 0;
+					for(int c = 0; c < 14 && found < SELF_COLLISION_MAX_PAIRS_PER_PARTICLE; c++)
+					{
+						// c = 0 is the cell itself (each pair stored by the first in the sorted order),
+						// the others the forward half of the neighbourhood
+						const glm::ivec3 other = cell + ForwardOffset(c);
+						for(uint32_t k = c == 0 ? s + 1 : rangeBegin[c]; k < rangeEnd[c]; k++)
+						{
+							const glm::vec3 d = sorted[k].pos - pos;
+							if(glm::dot(d, d) >= searchRadius2 || sorted[k].cell != other || AreNeighbours(topology, origin, sorted[k].origin))
+								continue;
+							slots[found++] = sorted[k].index;
+							if(found == SELF_COLLISION_MAX_PAIRS_PER_PARTICLE)
+								break;
+						}
+					}
+					pairCount[i] = found;
+				}
+				first = last;
+			}
+		}
+
+		for(int i = 0; i < n; i++)
+		{
+			for(uint32_t s = 0; s < pairCount[i]; s++)
+			{
+				pairs.push_back((uint32_t)i);
+				pairs.push_back(pairSlots[(size_t)i * SELF_COLLISION_MAX_PAIRS_PER_PARTICLE + s]);
+			}
+		}
+	}
+
+	// Push apart the active pairs closer than thickness, called once per solver iteration
+	void Solve(std::vector<Particle> &particles) const
+	{
+		for(size_t k = 0; k < activePairs.size(); k += 2)
+		{
+			Particle &p1 = particles[activePairs[k]];
+			Particle &p2 = particles[activePairs[k+1]];
+			const glm::vec3 d = p2.pos - p1.pos;
+			const float distance2 = glm::dot(d, d);
+			if(distance2 >= thickness * thickness || distance2 < 1e-12f)
+				continue;
+
+			const float w1 = p1.movable ? 1.0f : 0.0f;
+			const float w2 = p2.movable ? 1.0f : 0.0f;
+			if(w1 + w2 == 0.0f)
+				continue;
+
+			const float distance = glm::sqrt(distance2);
+			const glm::vec3 correction = d * ((thickness - distance) / (distance * (w1 + w2)));
+			p1.offsetPos(-correction * w1);
+			p2.offsetPos(correction * w2);
+		}
+	}
+};
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+
+#define CLOTH_SNAPSHOT_MAGIC 0x48544C43u // "CLTH"
+#define CLOTH_SNAPSHOT_VERSION 5u
+
+// Compact record of a constraint: particles are stored as indices, so the
+// snapshot stays valid when the particle vector is restored in place
+struct ConstraintRecord
+{
+	uint32_t p1;
+	uint32_t p2;
+	float restDistance;
+	uint8_t cuttable;
+	uint8_t level;
+	uint16_t batch;		// color batch of the constraint, no padding is left in the record
+};
+
+// Dihedral bending constraint: shared edge p1-p2, opposite vertices p3 and p4
+struct BendingRecord
+{
+	uint32_t p1;
+	uint32_t p2;
+	uint32_t p3;
+	uint32_t p4;
+	float restAngle;
+};
+
+// Binary state of a Cloth (positions, previous positions, pin mask, torn-edge state).
+// The vectors are reused between saves, so after the first save taking or restoring
+// a snapshot is a plain copy without reallocations
+class ClothSnapshot
+{
+private:
+	template<typename T>
+	static void WriteVector(std::ofstream &file, const std::vector<T> &v){
+		if(!v.empty())
+			file.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+	}
+	template<typename T>
+	static void ReadVector(std::ifstream &file, std::vector<T> &v, size_t count){
+		v.resize(count);
+		if(count > 0)
+			file.read(reinterpret_cast<char*>(v.data()), count * sizeof(T));
+	}
+
+public:
+	int dim;
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> oldPositions;
+	std::vector<uint8_t> pinned;		// 1 = particle not movable
+	std::vector<uint8_t> renderable;	// 0 = particle removed by a cut
+	std::vector<ConstraintRecord> constraints;	// constraints still alive (torn ones are missing)
+	std::vector<BendingRecord> bendingConstraints;
+	std::vector<uint32_t> origins;		// particle each one was split from (itself if not a copy)
+	std::vector<uint32_t> triangles;	// triangles with the split particles
+
+	ClothSnapshot() : dim(0) {}
+
+	bool IsEmpty() const { return positions.empty(); }
+
+	bool WriteToFile(const std::string &path) const {
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if(!file){
+			std::cout << "ERROR::CLOTH_SNAPSHOT:: cannot open " << path << " for writing" << std::endl;
+			return false;
+		}
+
+		uint32_t header[7] = {
+			CLOTH_SNAPSHOT_MAGIC,
+			CLOTH_SNAPSHOT_VERSION,
+			(uint32_t)dim,
+			(uint32_t)positions.size(),
+			(uint32_t)constraints.size(),
+			(uint32_t)bendingConstraints.size(),
+			(uint32_t)triangles.size()
+		};
+		file.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+		WriteVector(file, positions);
+		WriteVector(file, oldPositions);
+		WriteVector(file, pinned);
+		WriteVector(file, renderable);
+		WriteVector(file, constraints);
+		WriteVector(file, bendingConstraints);
+		WriteVector(file, origins);
+		WriteVector(file, triangles);
+
+		return file.good();
+	}
+
+	bool ReadFromFile(const std::string &path){
+		std::ifstream file(path, std::ios::binary);
+		if(!file){
+			std::cout << "ERROR::CLOTH_SNAPSHOT:: cannot open " << path << " for reading" << std::endl;
+			return false;
+		}
+
+		uint32_t header[7];
+		file.read(reinterpret_cast<char*>(header), sizeof(header));
+		if(!file || header[0] != CLOTH_SNAPSHOT_MAGIC || header[1] != CLOTH_SNAPSHOT_VERSION){
+			std::cout << "ERROR::CLOTH_SNAPSHOT:: " << path << " is not a valid cloth snapshot" << std::endl;
+			return false;
+		}
+
+		dim = (int)header[2];
+		size_t particleCount = header[3];
+		size_t constraintCount = header[4];
+		size_t bendingCount = header[5];
+		size_t triangleIndexCount = header[6];
+
+		// the counts must match the size of the file before anything is allocated
+		const std::streamoff dataStart = file.tellg();
+		file.seekg(0, std::ios::end);
+		const uint64_t remaining = (uint64_t)(file.tellg() - dataStart);
+		file.seekg(dataStart);
+		const uint64_t expected = (uint64_t)particleCount * (2 * sizeof(glm::vec3) + 2 * sizeof(uint8_t) + sizeof(uint32_t)) +
+									(uint64_t)constraintCount * sizeof(ConstraintRecord) +
+									(uint64_t)bendingCount * sizeof(BendingRecord) +
+									(uint64_t)triangleIndexCount * sizeof(uint32_t);
+		if(!file || remaining != expected){
+			std::cout << "ERROR::CLOTH_SNAPSHOT:: " << path << " has a size different from its header" << std::endl;
+			positions.clear();
+			return false;
+		}
+
+		ReadVector(file, positions, particleCount);
+		ReadVector(file, oldPositions, particleCount);
+		ReadVector(file, pinned, particleCount);
+		ReadVector(file, renderable, particleCount);
+		ReadVector(file, constraints, constraintCount);
+		ReadVector(file, bendingConstraints, bendingCount);
+		ReadVector(file, origins, particleCount);
+		ReadVector(file, triangles, triangleIndexCount);
+
+		if(!file){
+			std::cout << "ERROR::CLOTH_SNAPSHOT:: " << path << " is truncated" << std::endl;
+			positions.clear();
+			return false;
+		}
+		return true;
+	}
+};
@@ -0,0 +1,425 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/type_precision.hpp>
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <utility>
+#include <unordered_map>
+#include <cmath>
+#include <cfloat>
+#include <cstdint>
+#include <algorithm>
+
+#define CLOTH_PATCH_SIZE 16	// patches are CLOTH_PATCH_SIZE x CLOTH_PATCH_SIZE particles
+
+// Connection between two particles of the template, the rest distance is
+// expressed in units of particle distance so the same template fits every cloth size
+struct TopologyEdge
+{
+	unsigned int p1;
+	unsigned int p2;
+	float restScale;
+	unsigned int level;
+};
+
+// Immutable connectivity of a cloth: constraints, color batches, triangles and adjacency.
+// Edges are sorted by level and, inside a level, by color: two edges of the same
+// batch never share a particle, so a batch can be solved in any order (or in parallel).
+// For grids, level l connects particles at distance l; for meshes, level 1 are the
+// triangle edges (stretch) and level 2 the opposite vertices of adjacent triangles (bending)
+class ClothTopology
+{
+public:
+	int dim;				// 0 for topologies built from a mesh
+	unsigned int particleCount;
+	unsigned int constraintLevel;
+
+	std::vector<TopologyEdge> edges;
+	std::vector<unsigned int> levelOffsets;	// edges of level l are in [levelOffsets[l-1], levelOffsets[l])
+	std::vector<unsigned int> batchOffsets;	// edges of batch b are in [batchOffsets[b], batchOffsets[b+1])
+	std::vector<GLuint> triangles;			// index list with every particle renderable
+
+	// Adjacency in CSR form: the neighbours (through level 1 edges) of particle p are
+	// adjacency[adjacencyOffsets[p] .. adjacencyOffsets[p+1])
+	std::vector<unsigned int> adjacencyOffsets;
+	std::vector<unsigned int> adjacency;
+
+	// Pairs of triangles sharing an edge, 4 indices per pair: the shared edge (a, b)
+	// and the two opposite vertices, with the dihedral angle between the two triangles at rest.
+	// Used by the dihedral bending constraints
+	std::vector<unsigned int> bendingQuads;
+	std::vector<float> bendingRestAngles;
+
+	// Particles grouped in spatially compact patches, patch k is
+	// patchParticles[patchOffsets[k] .. patchOffsets[k+1]). Grids are split in square blocks,
+	// meshes in runs of CLOTH_PATCH_SIZE^2 particles along a Morton curve of the rest positions
+	std::vector<unsigned int> patchOffsets;
+	std::vector<unsigned int> patchParticles;
+	std::vector<unsigned int> particlePatch;	// patch of each particle
+
+	unsigned int ParticleCount() const { return particleCount; }
+	bool IsGrid() const { return dim > 0; }
+	unsigned int PatchCount() const { return patchOffsets.empty() ? 0 : (unsigned int)patchOffsets.size() - 1; }
+	unsigned int BatchCount() const { return batchOffsets.empty() ? 0 : (unsigned int)batchOffsets.size() - 1; }
+
+	static std::shared_ptr<const ClothTopology> BuildGrid(int dim, unsigned int constraintLevel)
+	{
+		std::shared_ptr<ClothTopology> topology = std::make_shared<ClothTopology>();
+		topology->dim = dim;
+		topology->particleCount = (unsigned int)(dim * dim);
+		topology->constraintLevel = constraintLevel;
+
+		const float diagonal = glm::sqrt(2.0f);
+		topology->levelOffsets.push_back(0);
+		topology->batchOffsets.push_back(0);
+
+		std::vector<TopologyEdge> levelEdges;
+		for(unsigned int level = 1; level <= constraintLevel; level++)
+		{
+			const int i = (int)level;
+			levelEdges.clear();
+			for(int x=0; x < dim; x++)
+			{
+				for(int y=0; y < dim; y++)
+				{
+					const unsigned int p = x*dim + y;
+					if(y+i < dim) levelEdges.push_back({p, (unsigned int)(x*dim + y+i), (float)i, level});
+					if(x+i < dim) levelEdges.push_back({p, (unsigned int)((x+i)*dim + y), (float)i, level});
+					if(y+i < dim && x+i < dim) levelEdges.push_back({p, (unsigned int)((x+i)*dim + y+i), diagonal * i, level});
+				}
+			}
+
+			topology->AppendColored(levelEdges);
+			topology->levelOffsets.push_back((unsigned int)topology->edges.size());
+		}
+
+		for(int x = 0; x < dim-1; x++)
+		{
+			for(int y=0; y < dim-1; y++)
+			{
+				topology->triangles.push_back((x)*dim +y);
+				topology->triangles.push_back((x)*dim +(y+1));
+				topology->triangles.push_back((x+1)*dim +(y));
+
+				topology->triangles.push_back((x+1)*dim +(y));
+				topology->triangles.push_back((x)*dim +(y+1));
+				topology->triangles.push_back((x+1)*dim +(y+1));
+			}
+		}
+
+		topology->BuildAdjacency();
+		topology->BuildBendingQuads(nullptr);	// the grid is created flat
+
+		topology->patchOffsets.push_back(0);
+		for(int bx = 0; bx < dim; bx += CLOTH_PATCH_SIZE)
+		{
+			for(int by = 0; by < dim; by += CLOTH_PATCH_SIZE)
+			{
+				for(int x = bx; x < glm::min(bx + CLOTH_PATCH_SIZE, dim); x++)
+					for(int y = by; y < glm::min(by + CLOTH_PATCH_SIZE, dim); y++)
+						topology->patchParticles.push_back(x*dim + y);
+				topology->patchOffsets.push_back((unsigned int)topology->patchParticles.size());
+			}
+		}
+		topology->BuildParticlePatch();
+		return topology;
+	}
+
+	// Topology of an arbitrary triangle mesh. Vertices falling in the same cell of size weldDistance
+	// are welded in a single particle (OBJ files split vertices on UV seams), weldedPositions receives
+	// the position of each particle. Rest lengths are absolute (restScale is the distance)
+	static std::shared_ptr<const ClothTopology> BuildFromMesh(const std::vector<glm::vec3> &positions, const std::vector<GLuint> &meshIndices,
+																std::vector<glm::vec3> &weldedPositions, float weldDistance)
+	{
+		std::shared_ptr<ClothTopology> topology = std::make_shared<ClothTopology>();
+		topology->dim = 0;
+		topology->constraintLevel = 2;
+
+		// Welding: vertices are hashed on a grid with cells of weldDistance. The key mixes the full
+		// cell coordinates, a vertex is welded only to one in the same cell (keys may collide)
+		std::vector<unsigned int> remap(positions.size());
+		std::unordered_multimap<uint64_t, unsigned int> cells;
+		std::vector<glm::i64vec3> weldedCells;
+		weldedPositions.clear();
+		const double invCell = 1.0 / glm::max(weldDistance, 1e-7f);
+		for(size_t v = 0; v < positions.size(); v++)
+		{
+			const glm::vec3 &pos = positions[v];
+			const glm::i64vec3 cell = glm::i64vec3(std::floor(pos.x * invCell + 0.5), std::floor(pos.y * invCell + 0.5), std::floor(pos.z * invCell + 0.5));
+			const uint64_t key = ((uint64_t)cell.x * 0x9E3779B97F4A7C15ull) ^ ((uint64_t)cell.y * 0xC2B2AE3D27D4EB4Full) ^ ((uint64_t)cell.z * 0x165667B19E3779F9ull);
+
+			remap[v] = (unsigned int)weldedPositions.size();
+			std::pair<std::unordered_multimap<uint64_t, unsigned int>::iterator, std::unordered_multimap<uint64_t, unsigned int>::iterator> range = cells.equal_range(key);
+			for(std::unordered_multimap<uint64_t, unsigned int>::iterator it = range.first; it != range.second; it++){
+				if(weldedCells[it->second] == cell){
+					remap[v] = it->second;
+					break;
+				}
+			}
+			if(remap[v] == weldedPositions.size()){
+				cells.insert(std::make_pair(key, remap[v]));
+				weldedCells.push_back(cell);
+				weldedPositions.push_back(pos);
+			}
+		}
+		topology->particleCount = (unsigned int)weldedPositions.size();
+
+		for(size_t t = 0; t + 2 < meshIndices.size(); t += 3)
+		{
+			const GLuint a = remap[meshIndices[t]], b = remap[meshIndices[t+1]], c = remap[meshIndices[t+2]];
+			if(a == b || b == c || a == c)
+				continue;	// collapsed by the welding
+			topology->triangles.push_back(a);
+			topology->triangles.push_back(b);
+			topology->triangles.push_back(c);
+		}
+
+		// Unique edges with the vertices opposite to them in the (at most two) adjacent triangles
+		std::unordered_map<uint64_t, unsigned int> edgeIds;
+		std::vector<unsigned int> edgeVertices;	// 2 per edge
+		std::vector<int> opposite;				// 2 per edge, -1 if missing
+		for(size_t t = 0; t < topology->triangles.size(); t += 3)
+		{
+			for(int k = 0; k < 3; k++)
+			{
+				const unsigned int a = topology->triangles[t + k];
+				const unsigned int b = topology->triangles[t + (k+1)%3];
+				const unsigned int o = topology->triangles[t + (k+2)%3];
+				const uint64_t key = ((uint64_t)glm::min(a, b) << 32) | glm::max(a, b);
+				std::unordered_map<uint64_t, unsigned int>::iterator it = edgeIds.find(key);
+				if(it == edgeIds.end()){
+					edgeIds[key] = (unsigned int)(edgeVertices.size() / 2);
+					edgeVertices.push_back(a);
+					edgeVertices.push_back(b);
+					opposite.push_back((int)o);
+					opposite.push_back(-1);
+				} else if(opposite[it->second * 2 + 1] == -1){
+					opposite[it->second * 2 + 1] = (int)o;
+				}
+			}
+		}
+
+		std::vector<TopologyEdge> stretch;
+		std::vector<TopologyEdge> bending;
+		for(size_t e = 0; e < edgeVertices.size() / 2; e++)
+		{
+			const unsigned int a = edgeVertices[e*2], b = edgeVertices[e*2 + 1];
+			stretch.push_back({a, b, glm::distance(weldedPositions[a], weldedPositions[b]), 1});
+
+			const int o1 = opposite[e*2], o2 = opposite[e*2 + 1];
+			if(o2 != -1 && o1 != o2)
+				bending.push_back({(unsigned int)o1, (unsigned int)o2, glm::distance(weldedPositions[o1], weldedPositions[o2]), 2});
+		}
+
+		topology->levelOffsets.push_back(0);
+		topology->batchOffsets.push_back(0);
+		topology->AppendColored(stretch);
+		topology->levelOffsets.push_back((unsigned int)topology->edges.size());
+		topology->AppendColored(bending);
+		topology->levelOffsets.push_back((unsigned int)topology->edges.size());
+
+		topology->BuildAdjacency();
+		topology->BuildBendingQuads(&weldedPositions);
+		topology->BuildMortonPatches(weldedPositions);
+		return topology;
+	}
+
+private:
+	// 10 bits per axis of the position in the bounding box, interleaved
+	static uint32_t MortonCode(const glm::vec3 &normalized)
+	{
+		uint32_t code = 0;
+		const glm::uvec3 q = glm::uvec3(glm::clamp(normalized, 0.0f, 1.0f) * 1023.0f);
+		for(int bit = 9; bit >= 0; bit--)
+			code = (code << 3) | (((q.x >> bit) & 1u) << 2) | (((q.y >> bit) & 1u) << 1) | ((q.z >> bit) & 1u);
+		return code;
+	}
+
+	void BuildMortonPatches(const std::vector<glm::vec3> &positions)
+	{
+		glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+		for(size_t p = 0; p < positions.size(); p++){
+			min = glm::min(min, positions[p]);
+			max = glm::max(max, positions[p]);
+		}
+		const glm::vec3 invSize = 1.0f / glm::max(max - min, glm::vec3(1e-6f));
+
+		std::vector<std::pair<uint32_t, unsigned int>> codes(positions.size());
+		for(size_t p = 0; p < positions.size(); p++)
+			codes[p] = std::make_pair(MortonCode((positions[p] - min) * invSize), (unsigned int)p);
+		std::sort(codes.begin(), codes.end());
+
+		patchParticles.resize(codes.size());
+		patchOffsets.assign(1, 0);
+		for(size_t p = 0; p < codes.size(); p++)
+		{
+			patchParticles[p] = codes[p].second;
+			if((p + 1) % (CLOTH_PATCH_SIZE * CLOTH_PATCH_SIZE) == 0 || p + 1 == codes.size())
+				patchOffsets.push_back((unsigned int)(p + 1));
+		}
+		BuildParticlePatch();
+	}
+
+	void BuildParticlePatch()
+	{
+		particlePatch.resize(particleCount);
+		for(unsigned int k = 0; k + 1 < patchOffsets.size(); k++)
+			for(unsigned int i = patchOffsets[k]; i < patchOffsets[k+1]; i++)
+				particlePatch[patchParticles[i]] = k;
+	}
+
+	// Every interior edge of the triangle list gives a quad (a, b, opposite1, opposite2).
+	// Without positions the rest angle is pi (flat surface)
+	void BuildBendingQuads(const std::vector<glm::vec3> *positions)
+	{
+		std::unordered_map<uint64_t, unsigned int> firstOpposite;	// edge -> its pending entry, UINT32_MAX once paired
+		std::vector<unsigned int> pending;							// 3 per edge seen once: a, b, opposite
+		bendingQuads.clear();
+		for(size_t t = 0; t < triangles.size(); t += 3)
+		{
+			for(int k = 0; k < 3; k++)
+			{
+				const unsigned int a = triangles[t + k];
+				const unsigned int b = triangles[t + (k+1)%3];
+				const unsigned int o = triangles[t + (k+2)%3];
+				const uint64_t key = ((uint64_t)glm::min(a, b) << 32) | glm::max(a, b);
+				std::unordered_map<uint64_t, unsigned int>::iterator it = firstOpposite.find(key);
+				if(it == firstOpposite.end()){
+					firstOpposite[key] = (unsigned int)pending.size();
+					pending.push_back(a);
+					pending.push_back(b);
+					pending.push_back(o);
+				} else if(it->second != UINT32_MAX){
+					const unsigned int *first = &pending[it->second];
+					if(first[2] != o){
+						bendingQuads.push_back(first[0]);
+						bendingQuads.push_back(first[1]);
+						bendingQuads.push_back(first[2]);
+						bendingQuads.push_back(o);
+					}
+					it->second = UINT32_MAX;	// non-manifold edges keep only the first pair
+				}
+			}
+		}
+
+		bendingRestAngles.assign(bendingQuads.size() / 4, glm::pi<float>());
+		if(positions == nullptr)
+			return;
+		for(size_t q = 0; q < bendingRestAngles.size(); q++)
+		{
+			const glm::vec3 &p1 = (*positions)[bendingQuads[q*4]];
+			const glm::vec3 e = (*positions)[bendingQuads[q*4 + 1]] - p1;
+			const glm::vec3 n1 = glm::cross(e, (*positions)[bendingQuads[q*4 + 2]] - p1);
+			const glm::vec3 n2 = glm::cross(e, (*positions)[bendingQuads[q*4 + 3]] - p1);
+			const float l1 = glm::length(n1), l2 = glm::length(n2);
+			if(l1 > 1e-8f && l2 > 1e-8f)
+				bendingRestAngles[q] = glm::acos(glm::clamp(glm::dot(n1, n2) / (l1 * l2), -1.0f, 1.0f));
+		}
+	}
+
+	// Counting pass followed by a filling pass for both the CSR arrays
+	void BuildAdjacency()
+	{
+		const unsigned int n = ParticleCount();
+
+		adjacencyOffsets.assign(n + 1, 0);
+		const unsigned int firstLevelEnd = levelOffsets.size() > 1 ? levelOffsets[1] : 0;
+		for(unsigned int e = 0; e < firstLevelEnd; e++)
+		{
+			adjacencyOffsets[edges[e].p1 + 1]++;
+			adjacencyOffsets[edges[e].p2 + 1]++;
+		}
+		for(unsigned int p = 0; p < n; p++)
+			adjacencyOffsets[p + 1] += adjacencyOffsets[p];
+
+		adjacency.resize(adjacencyOffsets[n]);
+		std::vector<unsigned int> cursor(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for(unsigned int e = 0; e < firstLevelEnd; e++)
+		{
+			adjacency[cursor[edges[e].p1]++] = edges[e].p2;
+			adjacency[cursor[edges[e].p2]++] = edges[e].p1;
+		}
+	}
+
+	// Greedy coloring of the edges: each edge takes the first color not used
+	// by the other edges of its two particles. The colored edges are appended grouped by color,
+	// a batch for each color (the last color may repeat a particle past maxColors - 1 edges on it)
+	void AppendColored(const std::vector<TopologyEdge> &newEdges)
+	{
+		const unsigned int maxColors = 128;
+		std::vector<uint64_t> usedColors(ParticleCount() * 2, 0);
+		std::vector<unsigned int> colors(newEdges.size());
+		unsigned int colorCount = 0;
+
+		for(size_t e = 0; e < newEdges.size(); e++)
+		{
+			const uint64_t* used1 = &usedColors[newEdges[e].p1 * 2];
+			const uint64_t* used2 = &usedColors[newEdges[e].p2 * 2];
+			unsigned int color = 0;
+			while(color < maxColors - 1 && (((used1[color / 64] | used2[color / 64]) >> (color % 64)) & 1u))
+				color++;
+
+			usedColors[newEdges[e].p1 * 2 + color / 64] |= (uint64_t)1 << (color % 64);
+			usedColors[newEdges[e].p2 * 2 + color / 64] |= (uint64_t)1 << (color % 64);
+			colors[e] = color;
+			colorCount = glm::max(colorCount, color + 1);
+		}
+
+		for(unsigned int color = 0; color < colorCount; color++)
+		{
+			for(size_t e = 0; e < newEdges.size(); e++)
+			{
+				if(colors[e] == color)
+					edges.push_back(newEdges[e]);
+			}
+			batchOffsets.push_back((unsigned int)edges.size());
+		}
+	}
+};
+
+// Process-wide cache of the grid topologies, keyed by (dim, constraintLevel).
+// Templates are shared between all the cloths and never modified after creation
+class ClothTopologyCache
+{
+protected:
+	ClothTopologyCache(){}
+
+	static ClothTopologyCache* instance;
+	std::map<std::pair<int, unsigned int>, std::shared_ptr<const ClothTopology>> grids;
+public:
+	ClothTopologyCache(ClothTopologyCache &other) = delete;
+	void operator = (const ClothTopologyCache &) = delete;
+
+	static ClothTopologyCache *GetInstance();
+
+	std::shared_ptr<const ClothTopology> GetGrid(int dim, unsigned int constraintLevel)
+	{
+		std::pair<int, unsigned int> key(dim, constraintLevel);
+		std::map<std::pair<int, unsigned int>, std::shared_ptr<const ClothTopology>>::iterator it = grids.find(key);
+		if(it != grids.end())
+			return it->second;
+
+		std::shared_ptr<const ClothTopology> topology = ClothTopology::BuildGrid(dim, constraintLevel);
+		grids[key] = topology;
+		return topology;
+	}
+
+	void CleanUp(){
+		grids.clear();
+	}
+};
+
+ClothTopologyCache* ClothTopologyCache::instance = nullptr;
+
+ClothTopologyCache *ClothTopologyCache::GetInstance(){
+	if(instance == nullptr){
+		instance = new ClothTopologyCache();
+	}
+
+	return instance;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <utils/Particle.h>
+
+#include <cstdint>
+#include <cstring>
+
+#define CLOTH_VERTEX_HALF_MAX 65504.0f	// largest finite half float, the forces are clamped to it
+
+/*
+	Vertex of the cloth as read by the shaders, written from the particles every frame:
+	the simulation state (old position, mass, flags) stays on the CPU.
+	The normal is octahedral encoded in two normalized shorts (location 1, decoded in the vertex
+	shader), the force shown by the shaders is in half floats (location 2, the fourth is padding).
+	The color is the same for all the particles, it is the uniform clothColor
+*/
+struct ClothVertex
+{
+	glm::vec3 pos;			// location 0
+	GLshort normal[2];		// location 1
+	GLhalf force[4];		// location 2
+
+	void Pack(const Particle &particle)
+	{
+		pos = particle.pos;
+
+		const glm::vec2 octahedral = EncodeOctahedral(particle.normal);
+		normal[0] = ToSnorm16(octahedral.x);
+		normal[1] = ToSnorm16(octahedral.y);
+
+		const glm::vec3 f = glm::clamp(particle.shader_force, glm::vec3(-CLOTH_VERTEX_HALF_MAX), glm::vec3(CLOTH_VERTEX_HALF_MAX));
+		force[0] = ToHalf(f.x);
+		force[1] = ToHalf(f.y);
+		force[2] = ToHalf(f.z);
+		force[3] = 0;
+	}
+
+	// x in [-1, 1], rounded to the nearest
+	static GLshort ToSnorm16(float x)
+	{
+		return (GLshort)(x * 32767.0f + (x >= 0.0f ? 0.5f : -0.5f));
+	}
+
+	// Finite x within the half range, rounded to the nearest even. The values below the smallest
+	// normal half (6.1e-5) become zero: no denormals, the conversion has a single branch
+	static GLhalf ToHalf(float x)
+	{
+		uint32_t bits;
+		memcpy(&bits, &x, sizeof(bits));
+		const uint32_t sign = (bits >> 16) & 0x8000u;
+		bits &= 0x7FFFFFFFu;
+		if(bits < 0x38800000u)
+			return (GLhalf)sign;
+		bits -= 0x38000000u;	// exponent bias from 127 to 15
+		return (GLhalf)(sign | ((bits + 0x0FFFu + ((bits >> 13) & 1u)) >> 13));
+	}
+
+	// The direction on the octahedron |x|+|y|+|z| = 1, the lower half folded over the upper one.
+	// A zero vector (particle without triangles) becomes +z
+	static glm::vec2 EncodeOctahedral(glm::vec3 n)
+	{
+		const float l1 = glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+		if(l1 < 1e-20f)
+			return glm::vec2(0.0f);
+		n *= 1.0f / l1;
+		glm::vec2 e = glm::vec2(n.x, n.y);
+		if(n.z < 0.0f){
+			const glm::vec2 signs = glm::vec2(e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f);
+			e = (glm::vec2(1.0f) - glm::abs(glm::vec2(e.y, e.x))) * signs;
+		}
+		return e;
+	}
+
+	// Same decoding of the vertex shaders
+	static glm::vec3 DecodeOctahedral(glm::vec2 e)
+	{
+		glm::vec3 n = glm::vec3(e.x, e.y, 1.0f - glm::abs(e.x) - glm::abs(e.y));
+		const float t = glm::max(-n.z, 0.0f);
+		n.x += n.x >= 0.0f ? -t : t;
+		n.y += n.y >= 0.0f ? -t : t;
+		return glm::normalize(n);
+	}
+};
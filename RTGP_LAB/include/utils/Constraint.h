@@ -1,7 +1,8 @@
 #pragma once
 
 #include <utils/particle.h>
-#include <utils/particlesToCut.h>
+
+#define CONSTRAINT_NO_BATCH 0xFFFFu	// not in a color batch of the topology: solved alone
 
 class Constraint
 {
@@ -11,28 +12,40 @@ private:
 public:
 	Particle *p1, *p2; // the two particles that are connected through this constraint
 	bool cuttable;
+	unsigned int level; // distance in the grid between p1 and p2 (1 = neighbours)
+	unsigned int batch; // color batch of the topology edge: the constraints of a batch share no particle
 
-	Constraint(Particle *p1, Particle *p2, float rest, float cuttingMultiplier) :  p1(p1),p2(p2),rest_distance(rest),cuttable(false),cuttingDistanceMultiplier(cuttingMultiplier)
+	Constraint(Particle *p1, Particle *p2, float rest, float cuttingMultiplier, unsigned int level = 1, unsigned int batch = CONSTRAINT_NO_BATCH) :  p1(p1),p2(p2),rest_distance(rest),cuttable(false),cuttingDistanceMultiplier(cuttingMultiplier),level(level),batch(batch)
 	{
 	}
 
-	void satisfyPositionalConstraint(float K)
+	float getRestDistance() const { return rest_distance; }
+	float getCuttingMultiplier() const { return cuttingDistanceMultiplier; }
+
+	// The satisfy functions return true if the constraint is cuttable and stretched beyond
+	// the cutting distance, the cloth queues it for tearing
+	bool satisfyPositionalConstraint(float K)
 	{
-		glm::vec3 correctionVector = CalculateCorrectionVector(K);
+		bool overStretched;
+		glm::vec3 correctionVector = CalculateCorrectionVector(K, overStretched);
 
 		this->p1->offsetPos(correctionVector); 
 		this->p2->offsetPos(-correctionVector);	
+		return overStretched;
 	}
-	void satisfyPhysicsConstraint(float K)
+	bool satisfyPhysicsConstraint(float K)
 	{
-		glm::vec3 correctionVector = CalculateCorrectionVector(K);
+		bool overStretched;
+		glm::vec3 correctionVector = CalculateCorrectionVector(K, overStretched);
 
 		this->p1->addForce(correctionVector); 
 		this->p2->addForce(-correctionVector);	
+		return overStretched;
 	}
 
-	void satisfyAdvancedPhysicalConstraint(float K, float U, float deltaTime){
-		glm::vec3 correctionVector = CalculateCorrectionVector(K);
+	bool satisfyAdvancedPhysicalConstraint(float K, float U, float deltaTime){
+		bool overStretched;
+		glm::vec3 correctionVector = CalculateCorrectionVector(K, overStretched);
 
 		this->p1->addForce(correctionVector);
 		this->p2->addForce(-correctionVector);
@@ -41,21 +54,15 @@ public:
 
 		this->p1->addForce(springFrictionVector);
 		this->p2->addForce(-springFrictionVector);
+		return overStretched;
 	}
 
 private:
-	glm::vec3 CalculateCorrectionVector(float K){
+	glm::vec3 CalculateCorrectionVector(float K, bool &overStretched){
 		glm::vec3 p1_to_p2 = this->p2->getPos() - this->p1->getPos(); // vector from p1 to p2
 		float current_distance = glm::length(p1_to_p2); // current distance between p1 and p2
 
-		if(cuttable){
-			if(current_distance >= rest_distance * cuttingDistanceMultiplier){
-				if(p1->movable)
-					ParticlesToCut::GetInstance()->particles.push_back(p1);
-				if(p2->movable)
-					ParticlesToCut::GetInstance()->particles.push_back(p2);
-			}
-		}
+		overStretched = cuttable && current_distance >= rest_distance * cuttingDistanceMultiplier;
 
 		p1_to_p2 /= current_distance;
 
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#define INCIDENCE_EMPTY 0xFFFFFFFFu
+
+/*
+	Constraints (or triangles) touching each particle: the constraints of particle p are
+	slots[begin[p] .. end[p]). Removing a constraint leaves a tombstone (INCIDENCE_EMPTY)
+	in the slots of its particles, so the lists never move. Together with the swap-remove of the
+	constraints vector (Replace renames the moved one) a removal costs O(degree).
+	Add reuses a tombstone, a full list is moved at the end of the slots with twice the room.
+	The lists are built lazily, after the constraints vector is refilled (MarkDirty)
+*/
+class ConstraintIncidence
+{
+public:
+	std::vector<uint32_t> begin;
+	std::vector<uint32_t> end;
+	std::vector<uint32_t> slots;
+	bool dirty;
+
+	ConstraintIncidence() : dirty(true) {}
+
+	void MarkDirty() { dirty = true; }
+
+	// particlesOf(c, out) writes the particles of constraint c in out and returns how many they are
+	template<typename ParticlesOf>
+	void Build(size_t particleCount, size_t constraintCount, ParticlesOf particlesOf)
+	{
+		uint32_t particles[4];
+		begin.assign(particleCount, 0);
+		for(size_t c = 0; c < constraintCount; c++)
+		{
+			const int count = particlesOf(c, particles);
+			for(int k = 0; k < count; k++)
+				begin[particles[k]]++;
+		}
+		uint32_t total = 0;
+		for(size_t p = 0; p < particleCount; p++)
+		{
+			const uint32_t count = begin[p];
+			begin[p] = total;
+			total += count;
+		}
+
+		end = begin;	// used as fill cursor
+		slots.resize(total);
+		for(size_t c = 0; c < constraintCount; c++)
+		{
+			const int count = particlesOf(c, particles);
+			for(int k = 0; k < count; k++)
+				slots[end[particles[k]]++] = (uint32_t)c;
+		}
+		dirty = false;
+	}
+
+	void Remove(uint32_t particle, uint32_t constraint) { Replace(particle, constraint, INCIDENCE_EMPTY); }
+
+	// The constraint from of the particle is now the constraint to
+	void Replace(uint32_t particle, uint32_t from, uint32_t to)
+	{
+		for(uint32_t i = begin[particle]; i < end[particle]; i++)
+		{
+			if(slots[i] == from){
+				slots[i] = to;
+				return;
+			}
+		}
+	}
+
+	void Add(uint32_t particle, uint32_t constraint)
+	{
+		for(uint32_t i = begin[particle]; i < end[particle]; i++)
+		{
+			if(slots[i] == INCIDENCE_EMPTY){
+				slots[i] = constraint;
+				return;
+			}
+		}
+
+		// full: the list moves at the end, the old slots are left unused
+		const uint32_t size = end[particle] - begin[particle];
+		const uint32_t first = (uint32_t)slots.size();
+		slots.resize(first + (size > 2 ? size * 2 : 4), INCIDENCE_EMPTY);
+		for(uint32_t i = 0; i < size; i++)
+			slots[first + i] = slots[begin[particle] + i];
+		slots[first + size] = constraint;
+		begin[particle] = first;
+		end[particle] = (uint32_t)slots.size();
+	}
+};
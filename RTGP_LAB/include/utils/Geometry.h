@@ -0,0 +1,94 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Small geometric queries shared by the cloth structures and the colliders
+
+// Closest point of the triangle abc to p (Ericson, Real-Time Collision Detection 5.1.5)
+inline glm::vec3 ClosestPointOnTriangle(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c)
+{
+	const glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+	const float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+	if(d1 <= 0.0f && d2 <= 0.0f) return a;
+
+	const glm::vec3 bp = p - b;
+	const float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+	if(d3 >= 0.0f && d4 <= d3) return b;
+
+	const float vc = d1*d4 - d3*d2;
+	if(vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return a + ab * (d1 / (d1 - d3));
+
+	const glm::vec3 cp = p - c;
+	const float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+	if(d6 >= 0.0f && d5 <= d6) return c;
+
+	const float vb = d5*d2 - d1*d6;
+	if(vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return a + ac * (d2 / (d2 - d6));
+
+	const float va = d3*d6 - d5*d4;
+	if(va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+	const float denom = 1.0f / (va + vb + vc);
+	return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+// Closest point of the segment ab to p
+inline glm::vec3 ClosestPointOnSegment(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b)
+{
+	const glm::vec3 ab = b - a;
+	const float length2 = glm::dot(ab, ab);
+	if(length2 < 1e-12f)
+		return a;
+	return a + ab * glm::clamp(glm::dot(p - a, ab) / length2, 0.0f, 1.0f);
+}
+
+// Barycentric coordinates (wa, wb, wc) of a point p of the triangle abc
+inline glm::vec3 Barycentric(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c)
+{
+	const glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+	const float d00 = glm::dot(ab, ab), d01 = glm::dot(ab, ac), d11 = glm::dot(ac, ac);
+	const float d20 = glm::dot(ap, ab), d21 = glm::dot(ap, ac);
+	const float denom = d00 * d11 - d01 * d01;
+	if(glm::abs(denom) < 1e-12f)
+		return glm::vec3(1.0f, 0.0f, 0.0f);
+	const float v = (d11 * d20 - d01 * d21) / denom;
+	const float w = (d00 * d21 - d01 * d20) / denom;
+	return glm::vec3(1.0f - v - w, v, w);
+}
+
+// Closest points between the segment ab and the triangle (p0, p1, p2), found by alternating projections
+// on the two convex sets. A few rounds are enough for the contact distances of the collisions
+inline void ClosestPointsSegmentTriangle(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &p0, const glm::vec3 &p1, const glm::vec3 &p2,
+											glm::vec3 &onSegment, glm::vec3 &onTriangle)
+{
+	onSegment = ClosestPointOnSegment((p0 + p1 + p2) / 3.0f, a, b);
+	onTriangle = ClosestPointOnTriangle(onSegment, p0, p1, p2);
+	for(int i = 0; i < 4; i++)
+	{
+		onSegment = ClosestPointOnSegment(onTriangle, a, b);
+		onTriangle = ClosestPointOnTriangle(onSegment, p0, p1, p2);
+	}
+}
+
+// True if the segment ab crosses the triangle (p0, p1, p2) (Moller-Trumbore with t in [0, 1]).
+// tolerance enlarges the triangle in barycentric units, so that adjacent triangles leave no crack
+inline bool SegmentCrossesTriangle(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &p0, const glm::vec3 &p1, const glm::vec3 &p2, float tolerance = 0.0f)
+{
+	const glm::vec3 direction = b - a;
+	const glm::vec3 e1 = p1 - p0, e2 = p2 - p0;
+	const glm::vec3 p = glm::cross(direction, e2);
+	const float det = glm::dot(e1, p);
+	if(glm::abs(det) < 1e-12f)
+		return false;
+	const float invDet = 1.0f / det;
+	const glm::vec3 s = a - p0;
+	const float u = glm::dot(s, p) * invDet;
+	if(u < -tolerance || u > 1.0f + tolerance)
+		return false;
+	const glm::vec3 q = glm::cross(s, e1);
+	const float v = glm::dot(direction, q) * invDet;
+	if(v < -tolerance || u + v > 1.0f + tolerance)
+		return false;
+	const float t = glm::dot(e2, q) * invDet;
+	return t >= 0.0f && t <= 1.0f;
+}
@@ -30,10 +30,9 @@ public:
 	float mass;
 
 	glm::vec3 shader_force;
-	glm::vec3 color;
 	bool renderable;
 	
-	Particle(glm::vec3 pos, float m, glm::vec3 c) : pos(pos), normal(glm::vec3(1.0f)),  old_pos(pos),force(glm::vec3(0.0f)), mass(m), movable(true), color(c){
+	Particle(glm::vec3 pos, float m) : pos(pos), normal(glm::vec3(1.0f)),  old_pos(pos),force(glm::vec3(0.0f)), mass(m), movable(true){
 		renderable = true;
 	}
 	Particle(){}
@@ -60,6 +59,14 @@ public:
 		this->force = glm::vec3(0.0f);
 	}
 
+	// Step of a particle that does not move (sleeping island or removed): the forces are dropped
+	void RestStep()
+	{
+		if(movable)
+			this->shader_force = glm::vec3(force.x, force.y, force.z) + glm::vec3(0.1f);
+		this->force = glm::vec3(0.0f);
+	}
+
 	glm::vec3& getPos() {return pos;}
 
 	void resetForce() {this->force = glm::vec3(0.0f);}
@@ -176,6 +183,107 @@ public:
 		CapsuleCollision(capsuleCollider->p1->GetTranslationVector(), capsuleCollider->p2->GetTranslationVector(), capsuleCollider->radius);
 	}
 
+	// Continuous collision: the particle moved from old_pos to pos during the step while the sphere
+	// moved from previousCenter to center. If the relative motion enters the sphere, the particle
+	// is placed on the surface at the entry side (no tunnelling, even when it went through).
+	// Particles already inside at the start of the step are left to the discrete test
+	bool SweptSphereCollision(const glm::vec3 previousCenter, const glm::vec3 center, const float radius){
+		const float r = radius * COLLISION_OFFSET_MULTIPLIER;
+		const glm::vec3 start = old_pos - previousCenter;	// relative to the sphere
+		const glm::vec3 end = pos - center;
+		const glm::vec3 d = end - start;
+
+		const float a = glm::dot(d, d);
+		const float b = 2.0f * glm::dot(start, d);
+		const float c = glm::dot(start, start) - r*r;
+		if(c < 0.0f || a < 1e-12f)
+			return false;
+		const float discriminant = b*b - 4.0f*a*c;
+		if(discriminant < 0.0f)
+			return false;
+
+		const float timeOfImpact = (-b - glm::sqrt(discriminant)) / (2.0f * a);
+		if(timeOfImpact < 0.0f || timeOfImpact > 1.0f)
+			return false;
+
+		const glm::vec3 normal = glm::normalize(start + d * timeOfImpact);
+		this->offsetPos(center + normal * r - pos);
+		return true;
+	}
+	bool SweptSphereCollision(SphereCollider* sphereCollider){
+		return SweptSphereCollision(sphereCollider->PreviousCenter(), sphereCollider->Center(), sphereCollider->radius);
+	}
+
+	// Same for a capsule moving from (previousA, previousB) to (a, b). The motion is not a pure
+	// translation, so the time of impact is found marching the distance with steps of half the radius
+	// and refining the first penetrating interval by bisection
+	bool SweptCapsuleCollision(const glm::vec3 previousA, const glm::vec3 previousB, const glm::vec3 a, const glm::vec3 b, const float radius){
+		const float r = radius * COLLISION_OFFSET_MULTIPLIER;
+
+		const glm::vec3 particleMove = pos - old_pos;
+		const float maxMove = glm::max(glm::length((a - previousA) - particleMove), glm::length((b - previousB) - particleMove));
+		if(SegmentDistance(0.0f, previousA, previousB, a, b) < r)
+			return false;	// inside at the start
+		if(maxMove < 1e-6f)
+			return false;
+
+		const int samples = glm::clamp((int)glm::ceil(maxMove / (0.5f * r)), 1, 32);
+		float before = 0.0f;
+		float after = -1.0f;
+		for(int s = 1; s <= samples; s++){
+			const float t = (float)s / samples;
+			if(SegmentDistance(t, previousA, previousB, a, b) < r){
+				after = t;
+				break;
+			}
+			before = t;
+		}
+		if(after < 0.0f)
+			return false;
+
+		for(int i = 0; i < 8; i++){
+			const float t = 0.5f * (before + after);
+			if(SegmentDistance(t, previousA, previousB, a, b) < r)
+				after = t;
+			else
+				before = t;
+		}
+
+		// contact point and normal at the time of impact, carried to the final pose of the capsule
+		const float t = before;
+		const glm::vec3 p = glm::mix(old_pos, pos, t);
+		const glm::vec3 segmentA = glm::mix(previousA, a, t);
+		const glm::vec3 segmentB = glm::mix(previousB, b, t);
+		const float u = ClosestSegmentParameter(p, segmentA, segmentB);
+		glm::vec3 normal = p - glm::mix(segmentA, segmentB, u);
+		const float length = glm::length(normal);
+		if(length < 1e-8f)
+			return false;
+		normal /= length;
+
+		this->offsetPos(glm::mix(a, b, u) + normal * r - pos);
+		return true;
+	}
+	bool SweptCapsuleCollision(CapsuleCollider* capsuleCollider){
+		return SweptCapsuleCollision(capsuleCollider->PreviousA(), capsuleCollider->PreviousB(), capsuleCollider->A(), capsuleCollider->B(), capsuleCollider->radius);
+	}
+
+	static float ClosestSegmentParameter(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b){
+		const glm::vec3 ab = b - a;
+		const float length2 = glm::dot(ab, ab);
+		if(length2 < 1e-12f)
+			return 0.0f;
+		return glm::clamp(glm::dot(p - a, ab) / length2, 0.0f, 1.0f);
+	}
+
+	// Distance between the particle and the capsule segment, both interpolated at time t of the step
+	float SegmentDistance(float t, const glm::vec3 &previousA, const glm::vec3 &previousB, const glm::vec3 &a, const glm::vec3 &b) const {
+		const glm::vec3 p = glm::mix(old_pos, pos, t);
+		const glm::vec3 segmentA = glm::mix(previousA, a, t);
+		const glm::vec3 segmentB = glm::mix(previousB, b, t);
+		return glm::distance(p, glm::mix(segmentA, segmentB, ClosestSegmentParameter(p, segmentA, segmentB)));
+	}
+
 
 
 	void CubeCollision(glm::mat4 clothModelMatrix, const glm::vec3 cubeCenterInWorldSpace, const float edge){
@@ -214,7 +322,7 @@ public:
 			} 
 			else{
 				// Displace on Z
-				float displacement = glm::dot(distanceVector, glm::vec3(0.0f, 1.0f, 0.0f));
+				float displacement = glm::dot(distanceVector, glm::vec3(0.0f, 0.0f, 1.0f));
 				this->pos = glm::vec3(this->pos.x, this->pos.y, this->pos.z + displacement);
 			}
 		}
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <colliders/BoxCollider.h>
 #include <colliders/CapsuleCollider.h>
+#include <colliders/HeightfieldCollider.h>
 #include <colliders/PlaneCollider.h>
 #include <colliders/sphereCollider.h>
+#include <colliders/SDFCollider.h>
 #include "utils/renderableObject.h"
 
 
@@ -14,12 +17,24 @@ public:
     vector<PlaneCollider*> planes;
     vector<SphereCollider*> spheres;
     vector<CapsuleCollider*> capsules;
+    vector<BoxCollider*> boxes;
+    vector<SDFCollider*> sdfs;
+    vector<HeightfieldCollider*> heightfields;
 
     vector<RenderableObject*> renderableObjects;
 
     void (*Start)(Scene* thisScene);
     void (*Update)(Scene* thisScene);
 
+    // The colliders remember their pose at the end of each physics step,
+    // the cloth sweeps the movement between two steps (continuous collision)
+    void StoreColliderPoses(){
+        for(size_t i = 0; i < spheres.size(); i++)
+            spheres[i]->StorePose();
+        for(size_t i = 0; i < capsules.size(); i++)
+            capsules[i]->StorePose();
+    }
+
     Scene(){};
     ~Scene(){
     };
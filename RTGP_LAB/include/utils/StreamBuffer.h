@@ -0,0 +1,129 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstring>
+#include <cstddef>
+
+#define STREAM_BUFFER_SEGMENTS 3
+#define STREAM_BUFFER_FENCE_TIMEOUT 1000000000ull	// ns waited at most for the GPU to release a segment
+
+/*
+	Buffer written once per frame by the CPU and read by the draws of that frame.
+	It holds STREAM_BUFFER_SEGMENTS segments of the same size, used in turn: the data of a frame
+	goes in the next segment while the GPU may still read the previous ones, and a fence after the
+	draws tells when the segment is free again (usually at once, it was used two frames before).
+	With GL 4.4 the storage is immutable and persistently mapped (coherent): a frame is a memcpy
+	in the mapped pointer. Otherwise the segment is written with glBufferSubData in a buffer
+	allocated once. The storage never changes size: Create again for a different segment size.
+
+	The draws read segment Segment(): with the vertex attributes set once at offset 0, the base
+	vertex of a draw is Segment() * vertices per segment (glDrawElementsBaseVertex)
+*/
+class StreamBuffer
+{
+private:
+	GLuint buffer;
+	GLenum target;
+	size_t segmentSize;
+	unsigned int segment;	// the last written
+	GLsync fences[STREAM_BUFFER_SEGMENTS];
+	char* mapped;			// persistent mapping, nullptr on the glBufferSubData path
+
+	void WaitFence(unsigned int s)
+	{
+		if(fences[s] == 0)
+			return;
+		GLbitfield flags = 0;
+		while(true)
+		{
+			const GLenum result = glClientWaitSync(fences[s], flags, STREAM_BUFFER_FENCE_TIMEOUT);
+			if(result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED)
+				break;
+			flags = GL_SYNC_FLUSH_COMMANDS_BIT;	// the fence may still be in the command queue
+		}
+		glDeleteSync(fences[s]);
+		fences[s] = 0;
+	}
+
+public:
+	StreamBuffer() : buffer(0), target(GL_ARRAY_BUFFER), segmentSize(0), segment(0), mapped(nullptr)
+	{
+		for(int s = 0; s < STREAM_BUFFER_SEGMENTS; s++)
+			fences[s] = 0;
+	}
+
+	// Allocates the segments, the buffer stays bound to target
+	void Create(size_t segmentBytes, GLenum bufferTarget = GL_ARRAY_BUFFER)
+	{
+		Destroy();
+		target = bufferTarget;
+		segmentSize = segmentBytes;
+		segment = STREAM_BUFFER_SEGMENTS - 1;	// the first Write goes in segment 0
+		const GLsizeiptr total = (GLsizeiptr)(segmentSize * STREAM_BUFFER_SEGMENTS);
+
+		glGenBuffers(1, &buffer);
+		glBindBuffer(target, buffer);
+		if(GLAD_GL_VERSION_4_4){
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(target, total, nullptr, flags);
+			mapped = (char*)glMapBufferRange(target, 0, total, flags);
+			if(mapped != nullptr)
+				return;
+			// mapping refused: an immutable storage cannot be reallocated, a new buffer is needed
+			glDeleteBuffers(1, &buffer);
+			glGenBuffers(1, &buffer);
+			glBindBuffer(target, buffer);
+		}
+		glBufferData(target, total, nullptr, GL_STREAM_DRAW);
+	}
+
+	void Destroy()
+	{
+		for(int s = 0; s < STREAM_BUFFER_SEGMENTS; s++)
+		{
+			if(fences[s] != 0)
+				glDeleteSync(fences[s]);
+			fences[s] = 0;
+		}
+		if(buffer != 0){
+			if(mapped != nullptr){
+				glBindBuffer(target, buffer);
+				glUnmapBuffer(target);
+			}
+			glDeleteBuffers(1, &buffer);
+		}
+		buffer = 0;
+		mapped = nullptr;
+		segmentSize = 0;
+	}
+
+	GLuint Buffer() const { return buffer; }
+	size_t SegmentSize() const { return segmentSize; }
+	unsigned int Segment() const { return segment; }
+	bool IsPersistent() const { return mapped != nullptr; }
+
+	// Copies size bytes (at most a segment) in the next segment, after the GPU is done with it
+	void Write(const void* data, size_t size)
+	{
+		segment = (segment + 1) % STREAM_BUFFER_SEGMENTS;
+		WaitFence(segment);
+		if(size > segmentSize)
+			size = segmentSize;
+		const size_t offset = segment * segmentSize;
+		if(mapped != nullptr){
+			memcpy(mapped + offset, data, size);
+		} else {
+			glBindBuffer(target, buffer);
+			glBufferSubData(target, (GLintptr)offset, (GLsizeiptr)size, data);
+		}
+	}
+
+	// After the last draw reading the segment of this frame
+	void Fence()
+	{
+		if(fences[segment] != 0)
+			glDeleteSync(fences[segment]);
+		fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+};
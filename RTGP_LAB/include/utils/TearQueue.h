@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+/*
+	Constraints found over-stretched by the solver, waiting to be torn.
+	Push can be called by many threads at once without locks: a bit per constraint
+	(fetch_or) keeps every constraint at most once in the queue, so the slots taken with
+	fetch_add never exceed the number of constraints. Drain is called by one thread,
+	once per step, when no solver thread is pushing.
+	The indices are valid until the constraints vector changes: drain before removing constraints
+*/
+class TearQueue
+{
+private:
+	std::vector<uint32_t> items;
+	std::unique_ptr<std::atomic<uint32_t>[]> queued;	// one bit per constraint
+	size_t capacity;
+	std::atomic<uint32_t> count;
+
+public:
+	TearQueue() : capacity(0), count(0) {}
+
+	// Room for constraintCount constraints, the pending ones are dropped if it grows
+	void Reserve(size_t constraintCount)
+	{
+		if(constraintCount <= capacity)
+			return;
+		capacity = constraintCount;
+		items.resize(capacity);
+		const size_t words = (capacity + 31) / 32;
+		queued.reset(new std::atomic<uint32_t>[words]);
+		for(size_t i = 0; i < words; i++)
+			queued[i].store(0, std::memory_order_relaxed);
+		count.store(0, std::memory_order_relaxed);
+	}
+
+	// False if the constraint is already queued
+	bool Push(uint32_t constraint)
+	{
+		const uint32_t bit = 1u << (constraint & 31);
+		if(queued[constraint >> 5].fetch_or(bit, std::memory_order_relaxed) & bit)
+			return false;
+		items[count.fetch_add(1, std::memory_order_relaxed)] = constraint;
+		return true;
+	}
+
+	size_t Size() const { return count.load(std::memory_order_relaxed); }
+
+	// Calls f(constraint) for every queued constraint and empties the queue
+	template<typename F>
+	void Drain(F f)
+	{
+		const uint32_t n = count.load(std::memory_order_acquire);
+		for(uint32_t i = 0; i < n; i++)
+		{
+			f(items[i]);
+			queued[items[i] >> 5].store(0, std::memory_order_relaxed);
+		}
+		count.store(0, std::memory_order_relaxed);
+	}
+
+	void Clear() { Drain([](uint32_t){}); }
+};
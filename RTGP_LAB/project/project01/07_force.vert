@@ -1,9 +1,8 @@
 #version 410 core
 
 layout (location = 0) in vec3 position;
-layout (location = 1) in vec3 normal;
+layout (location = 1) in vec2 normal;
 layout (location = 2) in vec3 force;
-layout (location = 3) in vec3 color;
 
 uniform mat4 modelMatrix;
 uniform mat4 viewMatrix;
@@ -22,6 +21,16 @@ out vec4 posLightSpace;
 
 out vec3 colorForce;
 
+// the normal arrives octahedral encoded (two normalized shorts): the lower half of the octahedron is folded over the upper one
+vec3 OctahedralDecode(vec2 e)
+{
+  vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+  return normalize(n);
+}
+
 void main()
 {
   // vertex position in world coordinates
@@ -33,7 +42,7 @@ void main()
   vViewPosition = -mvPosition.xyz;
 
   // transformations are applied to the normal
-  vNormal = normalize( normalMatrix * normal );
+  vNormal = normalize( normalMatrix * OctahedralDecode(normal) );
 
   // light incidence directions in view coordinate
   lightDir = vec3(viewMatrix  * vec4(lightVector, 0.0));
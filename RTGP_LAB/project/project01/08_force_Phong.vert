@@ -21,7 +21,7 @@ Universita' degli Studi di Milano
 #version 410 core
 
 layout (location = 0) in vec3 position;
-layout (location = 1) in vec3 normal;
+layout (location = 1) in vec2 normal;
 layout (location = 2) in vec3 force;
 
 // vectors of lights positions (passed from the application)
@@ -50,6 +50,16 @@ out vec3 vViewPosition;
 
 out vec3 colorForce;
 
+// the normal arrives octahedral encoded (two normalized shorts): the lower half of the octahedron is folded over the upper one
+vec3 OctahedralDecode(vec2 e)
+{
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
 void main(){
 
     // vertex position in ModelView coordinate (see the last line for the application of projection)
@@ -60,7 +70,7 @@ void main(){
     vViewPosition = -mvPosition.xyz;
 
     // transformations are applied to the normal
-    vNormal = normalize( normalMatrix * normal );
+    vNormal = normalize( normalMatrix * OctahedralDecode(normal) );
 
     vec4 lightPos = viewMatrix  * vec4(light, 1.0);;
     lightDir = lightPos.xyz - mvPosition.xyz;
@@ -86,6 +86,8 @@ GLint LoadTexture(const char* path);
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void apply_camera_movements();
+void CursorRay(glm::mat4 projection, glm::mat4 view, glm::vec3 &origin, glm::vec3 &direction);
+void ProcessClothMouse(Cloth &cloth, glm::mat4 projection, glm::mat4 view);
 void imGuiSetup(GLFWwindow *window);
 void PrintVec3(glm::vec3* vec);
 void MoveSphere(Transform* sphere_transform , glm::vec3 direction, int action);
@@ -93,7 +95,7 @@ void MoveSphereAndCloth(Transform* sphere_transform , glm::vec3 direction, int a
 void RotateSphere(float angle, int action);
 void ForceBlinnPhongShaderSetup(Shader forceBlinnPhongShader, Transform clothTransform, glm::mat4 projection, glm::mat4 view);
 void ForceGGXShaderSetup(Shader forceGGXShader, Transform clothTransform, glm::mat4 projection, glm::mat4 view);
-void ColorGGXShaderSetup(Shader colorPhongShader, Transform clothTransform, glm::mat4 projection, glm::mat4 view);
+void ColorGGXShaderSetup(Shader colorPhongShader, Transform clothTransform, glm::mat4 projection, glm::mat4 view, glm::vec3 clothColor);
 void SetUpClothShader(Shader shader, Transform clothTransform, glm::mat4 projection, glm::mat4 view);
 void UpdateScene1 (Scene* scene);
 void UpdateScene2 (Scene* scene);
@@ -103,12 +105,19 @@ void ChangeScene(Scene* sceneToChange);
 void Start1(Scene* scene);
 void Start2(Scene* scene);
 void Start3(Scene* scene);
+ClothParameters CurrentClothParameters();
 
 bool keys[1024];
 bool R_KEY = false;
     GLfloat lastX, lastY;
 bool firstMouse = true;
 
+// mouse on the cloth: the left button drags a particle (released with SHIFT it stays pinned), the right button cuts
+GLboolean leftMouseDown = GL_FALSE;
+GLboolean rightMouseDown = GL_FALSE;
+GLboolean cuttingCloth = GL_FALSE;
+glm::vec3 lastCutOrigin, lastCutDirection;
+
 GLfloat deltaTime = 0.0f;
 GLfloat lastFrame = 0.0f;
 
@@ -177,6 +186,15 @@ int constraintIterations = 10;
 int constraintLevel = 1;
 int collisionIterations = 10;
 float cuttingDistanceMultiplier = 5.0f;
+bool bendingConstraints = false;
+float bendingStiffness = 0.5f;
+bool selfCollision = false;
+bool triangleCollision = false;
+
+// Cloth states: the initial one is used to reset the cloth, the other one is saved/restored from the GUI
+ClothSnapshot initialClothState;
+ClothSnapshot savedClothState;
+const char* clothStateFile = "cloth_state.bin";
 
 unsigned int windowSize = 100;
 unsigned int overlap = 10;
@@ -257,11 +275,12 @@ int main()
     std::cout << "Texture load: complete" << std::endl;
 
     Transform clothTransform(view);
-    Cloth cloth(clothDim, particleOffset, startingPosition, &clothTransform, pinned, springType, K, U, constraintIterations, gravity, mass, collisionIterations, constraintLevel, cuttingDistanceMultiplier);
+    Cloth cloth(CurrentClothParameters(), &clothTransform);
     
     std::cout << "Cloth Transform: complete" << std::endl;
 
     c = &cloth;
+    cloth.SaveSnapshot(initialClothState);
 
     PerformanceCalculator performanceCalculator(windowSize, overlap);
 
@@ -404,6 +423,23 @@ int main()
     SphereCollider sphereCollider4(&sphere4_transform, sphere4_transform.scale);
     scene3.spheres.push_back(&sphereCollider4);
 
+    // Cube under the cloth, next to the sphere, collided through the distance field baked from its model
+    // (the SDF collider does not support rotations, the quaternion stays the identity)
+    glm::quat cube_rotation = glm::angleAxis(0.0f, glm::vec3(0.0f, 1.0f, 0.0f));
+    Transform cube_transform;
+    cube_transform = Transform(view);
+    cube_transform.scale = 1.0f;
+    cube_transform.translation = cubePosition;
+    cube_transform.rotation = &cube_rotation;
+
+    GameObject* cube = new GameObject(&cube_transform, &cubeModel);
+    TextureParameter* cubeTextureParameter = new TextureParameter(true, 0, repeat);
+    RenderableObject* renderableCube = new RenderableObject(cube, cubeTextureParameter);
+    scene3.renderableObjects.push_back(renderableCube);
+
+    SDFCollider cubeCollider(cubeModel, &cube_transform, 0.05f);
+    scene3.sdfs.push_back(&cubeCollider);
+
     scene3.Start = Start3;
     scene3.Update = UpdateScene3;
     scenes.push_back(&scene3);
@@ -439,9 +475,29 @@ int main()
         ImGui::Text("Cloth simulation:");
         ImGui::NewLine;
         ImGui::Text("Framerate (ms): %d", (int)performanceCalculator.framerate);
+        ImGui::Text("Cloth pieces: %d (%d sleeping)", (int)cloth.IslandCount(), (int)cloth.SleepingIslandCount());
         ImGui::NewLine;
         ImGui::Text("Press P to Update Cloth");
         ImGui::NewLine;
+        if(ImGui::Button("Reset cloth")){
+            cloth.RestoreSnapshot(initialClothState);
+        }
+        ImGui::SameLine();
+        if(ImGui::Button("Save state")){
+            cloth.SaveSnapshot(savedClothState);
+        }
+        ImGui::SameLine();
+        if(ImGui::Button("Restore state")){
+            cloth.RestoreSnapshot(savedClothState);
+        }
+        if(ImGui::Button("Save state to file")){
+            cloth.SaveSnapshotToFile(clothStateFile);
+        }
+        ImGui::SameLine();
+        if(ImGui::Button("Load state from file")){
+            cloth.LoadSnapshotFromFile(clothStateFile);
+        }
+        ImGui::NewLine();
         ImGui::SliderInt("Grid dim", &clothDim, 10, 100);
         ImGui::NewLine;
         ImGui::SliderFloat("Particle offset", &particleOffset, 0.05f, 1.0f);
@@ -470,9 +526,11 @@ int main()
         ImGui::NewLine;
         ImGui::Text("Physic Simulation");
         ImGui::NewLine;
-        ImGui::SliderFloat("Gravity", &gravity, -0.0f, -9.8f);
+        if(ImGui::SliderFloat("Gravity", &gravity, -0.0f, -9.8f))
+            cloth.SetGravity(gravity);
         ImGui::NewLine;
-        ImGui::SliderFloat("Mass", &mass, 0.0f, 2.0f);
+        if(ImGui::SliderFloat("Mass", &mass, 0.0f, 2.0f))
+            cloth.SetMass(mass);
 
         ImGui::NewLine;
         ImGui::Text("Constraints");
@@ -481,20 +539,20 @@ int main()
             switch(type)
             {
             case 0:
-                //springType = POSITIONAL;
+                springType = POSITIONAL;
                 K = 0.5f;
                 gravity = -9.8f;
                 constraintIterations = 10;
                 break;
             case 1:
-                // springType = PHYSICAL;
+                springType = PHYSICAL;
                 K = 15.0f;
                 gravity = -9.8f;
                 constraintIterations = 5;
                 constraintLevel = 2;
                 break;
             case 2:
-                // springType = PHYSICAL_ADVANCED;
+                springType = PHYSICAL_ADVANCED;
                 K = 10.0f;
                 U = 0.1f;
                 gravity = -9.8f;
@@ -504,6 +562,13 @@ int main()
             default:
                 break;
             }
+            // the presets are applied to the running simulation, K only makes sense with its spring type
+            cloth.SetSpringsType(springType);
+            cloth.SetK(K);
+            cloth.SetU(U);
+            cloth.SetGravity(gravity);
+            cloth.SetConstraintIterations(constraintIterations);
+            cloth.SetConstraintLevel(constraintLevel);
         }
         ImGui::SameLine();
         switch (type)
@@ -521,7 +586,8 @@ int main()
             ImGui::Text("PHYSICAL_ADVANCED");
 
             ImGui::NewLine;
-            ImGui::SliderFloat("U", &U, 0.00f, 2.0f);
+            if(ImGui::SliderFloat("U", &U, 0.00f, 2.0f))
+                cloth.SetU(U);
 
             break;
         default:
@@ -530,18 +596,40 @@ int main()
 
         // float K = 0.5f;
         ImGui::NewLine;
-        ImGui::SliderFloat("K", &K, 0.01f, 25.0f);
+        if(ImGui::SliderFloat("K", &K, 0.01f, 25.0f))
+            cloth.SetK(K);
 
         ImGui::NewLine;
-        ImGui::SliderInt("Constraint Iterations", &constraintIterations, 0, 25);
+        if(ImGui::SliderInt("Constraint Iterations", &constraintIterations, 0, 25))
+            cloth.SetConstraintIterations(constraintIterations);
 
         ImGui::NewLine;
-        ImGui::SliderInt("Constraint Level", &constraintLevel, 1, 5);
+        if(ImGui::SliderInt("Constraint Level", &constraintLevel, 1, 5))
+            cloth.SetConstraintLevel(constraintLevel);
+
+        ImGui::NewLine();
+        // the bending constraints replace the long range springs
+        if(ImGui::Checkbox("Dihedral bending", &bendingConstraints)){
+            if(bendingConstraints){
+                constraintLevel = 1;
+                cloth.SetConstraintLevel(constraintLevel);
+            }
+            cloth.SetBendingConstraints(bendingConstraints);
+        }
+        if(bendingConstraints){
+            if(ImGui::SliderFloat("Bending stiffness", &bendingStiffness, 0.0f, 1.0f))
+                cloth.SetBendingStiffness(bendingStiffness);
+        }
 
         ImGui::NewLine;
         ImGui::Text("Collisions");
         ImGui::NewLine;
-        ImGui::SliderInt("collisions Iterations", &collisionIterations, 0, 25);
+        if(ImGui::SliderInt("collisions Iterations", &collisionIterations, 0, 25))
+            cloth.SetCollisionIterations(collisionIterations);
+        if(ImGui::Checkbox("Self collision", &selfCollision))
+            cloth.SetSelfCollision(selfCollision);
+        if(ImGui::Checkbox("Triangle collision", &triangleCollision))
+            cloth.SetTriangleCollision(triangleCollision);
 
         ImGui::End();
 
@@ -565,6 +653,8 @@ int main()
             view
         );
 
+        ProcessClothMouse(cloth, projection, view);
+
         unsigned int maxIter = 4U;
         unsigned int physIter = 0U;
 
@@ -575,6 +665,7 @@ int main()
                 cloth.AddGravityForce();
                 physicsSimulation.FixedTimeStep();
                 cloth.PhysicsSteps(activeScene);
+                activeScene->StoreColliderPoses();
                 physIter++;
                 cloth.CheckForCuts();
 
@@ -597,16 +688,18 @@ int main()
             
         } else if(shaderNumber == 2) {
             color_shader.Use();
-            ColorGGXShaderSetup(color_shader, clothTransform, projection, view);
+            ColorGGXShaderSetup(color_shader, clothTransform, projection, view, cloth.Color());
         }
 
         cloth.Draw();
         
         if(!pKeyPressed && once)
         {
-            cloth.~Cloth();
             pinned = !pinned;
-            new(&cloth) Cloth(clothDim, particleOffset, startingPosition, &clothTransform, pinned, springType, K, U, constraintIterations, gravity, mass, collisionIterations, constraintLevel, cuttingDistanceMultiplier);
+            cloth.ResetToRest(CurrentClothParameters());
+            // the cloth is at rest again: with the pins and the cutting of the scene it is the new initial state
+            activeScene->Start(activeScene);
+            cloth.SaveSnapshot(initialClothState);
             once = false;
             //DebugLogStatus();
             //cloth.CutAHole(4 + iter, 4 + iter);
@@ -833,6 +926,14 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
           firstMouse = false;
       }
 
+      // while the cloth is dragged or cut the camera does not follow the cursor
+      if(c->IsGrabbing() || cuttingCloth)
+      {
+          lastX = xpos;
+          lastY = ypos;
+          return;
+      }
+
       // offset of mouse cursor position
       GLfloat xoffset = xpos - lastX;
       GLfloat yoffset = lastY - ypos;
@@ -846,6 +947,54 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 
 }
 
+//---------------------------------------------------------------------------------
+// World space ray through the cursor, from the near plane
+void CursorRay(glm::mat4 projection, glm::mat4 view, glm::vec3 &origin, glm::vec3 &direction)
+{
+    double xpos, ypos;
+    int width, height;
+    glfwGetCursorPos(window, &xpos, &ypos);
+    glfwGetWindowSize(window, &width, &height);
+
+    const glm::vec2 ndc(2.0f * (float)xpos / width - 1.0f, 1.0f - 2.0f * (float)ypos / height);
+    const glm::mat4 toWorld = glm::inverse(projection * view);
+    const glm::vec4 nearPoint = toWorld * glm::vec4(ndc, -1.0f, 1.0f);
+    const glm::vec4 farPoint = toWorld * glm::vec4(ndc, 1.0f, 1.0f);
+    origin = glm::vec3(nearPoint) / nearPoint.w;
+    direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+}
+
+//---------------------------------------------------------------------------------
+// Picking, dragging and cutting of the cloth with the mouse, once per frame (the clicks on the GUI are ignored)
+void ProcessClothMouse(Cloth &cloth, glm::mat4 projection, glm::mat4 view)
+{
+    const GLboolean left = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+    const GLboolean right = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS;
+    const bool onGui = ImGui::GetIO().WantCaptureMouse;
+
+    glm::vec3 origin, direction;
+    CursorRay(projection, view, origin, direction);
+
+    if(left && !leftMouseDown && !onGui)
+        cloth.Grab(origin, direction);
+    else if(left && cloth.IsGrabbing())
+        cloth.Drag(origin, direction);
+    else if(!left && cloth.IsGrabbing())
+        cloth.Release(keys[GLFW_KEY_LEFT_SHIFT]);
+
+    if(right && !rightMouseDown)
+        cuttingCloth = !onGui;
+    else if(right && cuttingCloth)
+        cloth.CutStroke(lastCutOrigin, lastCutDirection, origin, direction);
+    else if(!right)
+        cuttingCloth = GL_FALSE;
+
+    lastCutOrigin = origin;
+    lastCutDirection = direction;
+    leftMouseDown = left;
+    rightMouseDown = right;
+}
+
 // Scene rendering
 void RenderScene(Shader &shader, Scene &scene, glm::mat4 projection, glm::mat4 view){
     shader.Use();
@@ -995,6 +1144,8 @@ void ChangeScene(Scene* sceneToChange){
     previousActiveScene = activeScene;
     activeScene = sceneToChange;
     activeScene->Start(activeScene);
+    // Reset keeps the pins and the cutting chosen by the scene
+    c->UpdateSnapshotFlags(initialClothState);
 }
 
 void imGuiSetup(GLFWwindow *window)
@@ -1114,7 +1265,7 @@ void ForceGGXShaderSetup(Shader forceGGXShader, Transform clothTransform, glm::m
     glUniform1f(f0Location, F0_Sphere);
 
 }
-void ColorGGXShaderSetup(Shader colorGGXShader, Transform clothTransform, glm::mat4 projection, glm::mat4 view){
+void ColorGGXShaderSetup(Shader colorGGXShader, Transform clothTransform, glm::mat4 projection, glm::mat4 view, glm::vec3 clothColor){
 
     SetUpClothShader(colorGGXShader, clothTransform, projection, view);
 
@@ -1122,8 +1273,10 @@ void ColorGGXShaderSetup(Shader colorGGXShader, Transform clothTransform, glm::m
     GLint kdLocation = glGetUniformLocation(colorGGXShader.Program, "Kd");
     GLint alphaLocation = glGetUniformLocation(colorGGXShader.Program, "alpha");
     GLint f0Location = glGetUniformLocation(colorGGXShader.Program, "F0");
+    GLint clothColorLocation = glGetUniformLocation(colorGGXShader.Program, "clothColor");
     
     glUniform3fv(lightDirLocation, 1, glm::value_ptr(lightPosition));
+    glUniform3fv(clothColorLocation, 1, glm::value_ptr(clothColor));
     glUniform1f(kdLocation, Kd_GGXSphere);
     glUniform1f(alphaLocation, alpha_Sphere);
     glUniform1f(f0Location, F0_Sphere);
@@ -1135,6 +1288,28 @@ void SetUpClothShader(Shader shader, Transform clothTransform, glm::mat4 project
     glUniformMatrix4fv(glGetUniformLocation(shader.Program, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(view));
 }
 
+ClothParameters CurrentClothParameters(){
+    ClothParameters parameters;
+    parameters.dim = clothDim;
+    parameters.particleDistance = particleOffset;
+    parameters.topLeftPosition = startingPosition;
+    parameters.pinned = pinned;
+    parameters.springsType = springType;
+    parameters.K = K;
+    parameters.U = U;
+    parameters.constraintIterations = constraintIterations;
+    parameters.gravity = gravity;
+    parameters.mass = mass;
+    parameters.collisionIterations = collisionIterations;
+    parameters.constraintLevel = constraintLevel;
+    parameters.cuttingMultiplier = cuttingDistanceMultiplier;
+    parameters.bendingConstraints = bendingConstraints;
+    parameters.bendingStiffness = bendingStiffness;
+    parameters.selfCollision = selfCollision;
+    parameters.triangleCollision = triangleCollision;
+    return parameters;
+}
+
 void Start1(Scene* scene){
     glClearColor(0.988f, 0.804f, 0.98f, 1.0f);
 
@@ -1145,10 +1320,7 @@ void Start1(Scene* scene){
     c->getParticle(c->dim-1, c->dim-2, c->dim)->movable = true;
 
 
-    int numOfConstraints = c->constraints.capacity();
-    for(int i = 0; i < numOfConstraints; i++){
-        c->constraints[i].cuttable = false;
-    }
+    c->SetCuttable(false);
 
 }
 void Start2(Scene* scene){
@@ -1161,10 +1333,7 @@ void Start2(Scene* scene){
     c->getParticle(c->dim-1, c->dim-2, c->dim)->movable = true;
 
 
-    int numOfConstraints = c->constraints.capacity();
-    for(int i = 0; i < numOfConstraints; i++){
-        c->constraints[i].cuttable = false;
-    }
+    c->SetCuttable(false);
 
 }
 void Start3(Scene* scene){
@@ -1179,8 +1348,5 @@ void Start3(Scene* scene){
     c->getParticle(c->dim-1, c->dim-1, c->dim)->movable = false;
     c->getParticle(c->dim-1, c->dim-2, c->dim)->movable = false;
 
-    int numOfConstraints = c->constraints.capacity();
-    for(int i = 0; i < numOfConstraints; i++){
-        c->constraints[i].cuttable = true;
-    }
+    c->SetCuttable(true);
 }
\ No newline at end of file